@@ -0,0 +1,349 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Microbenchmarks of the cmpcov instrumentation callbacks. The callbacks are
+// invoked directly, so the program doesn't have to be built with
+// SanitizerCoverage or AddressSanitizer, and the results only reflect the
+// overhead of cmpcov itself. Every callback is measured in three scenarios:
+//
+// cold     - each call finds new traces (the traces are reset between rounds),
+// warm     - each call repeats a comparison which has been traced before,
+// disabled - the instrumentation is disabled with ASAN_OPTIONS=coverage=0.
+//
+// The configuration of cmpcov is only read once per process, so the program
+// runs itself as a child process for each configuration. The scaling with the
+// number of threads is measured in the default and the thread-local mode.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../source/cmpcov.h"
+
+extern "C" {
+void __sanitizer_cov_trace_cmp2(uint16_t Arg1, uint16_t Arg2);
+void __sanitizer_cov_trace_cmp4(uint32_t Arg1, uint32_t Arg2);
+void __sanitizer_cov_trace_cmp8(uint64_t Arg1, uint64_t Arg2);
+void __sanitizer_cov_trace_const_cmp2(uint16_t Arg1, uint16_t Arg2);
+void __sanitizer_cov_trace_const_cmp4(uint32_t Arg1, uint32_t Arg2);
+void __sanitizer_cov_trace_const_cmp8(uint64_t Arg1, uint64_t Arg2);
+void __sanitizer_cov_trace_switch(uint64_t Val, uint64_t *Cases);
+void __sanitizer_weak_hook_memcmp(void *caller_pc, const void *s1,
+                                  const void *s2, size_t n, int result);
+void __sanitizer_weak_hook_strncmp(void *caller_pc, const char *s1,
+                                   const char *s2, size_t n, int result);
+void __sanitizer_weak_hook_strcmp(void *caller_pc, const char *s1,
+                                  const char *s2, int result);
+}  // extern "C"
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#define COMPILER_BARRIER() _ReadWriteBarrier()
+#else
+#define NOINLINE __attribute__((noinline))
+#define COMPILER_BARRIER() asm volatile("" ::: "memory")
+#endif
+
+// The callbacks exercised by the benchmark.
+enum Callback {
+  kCmp2,
+  kCmp4,
+  kCmp8,
+  kConstCmp2,
+  kConstCmp4,
+  kConstCmp8,
+  kSwitchSmall,
+  kSwitchLarge,
+  kMemcmp,
+  kStrncmp,
+  kStrcmp,
+  kCallbacksCount
+};
+
+static const char *kCallbackNames[kCallbacksCount] = {
+  "trace_cmp2",
+  "trace_cmp4",
+  "trace_cmp8",
+  "trace_const_cmp2",
+  "trace_const_cmp4",
+  "trace_const_cmp8",
+  "trace_switch (4 cases)",
+  "trace_switch (256 cases)",
+  "weak_hook_memcmp",
+  "weak_hook_strncmp",
+  "weak_hook_strcmp",
+};
+
+// The number of distinct comparison sites used in the cold scenarios.
+const int kSitesCount = 256;
+
+// Operands of the comparisons, fully matching to generate the maximum number
+// of traces per call.
+static const uint64_t kOperand = 0x0123456789ABCDEFULL;
+static const char kString[] = "0123456789ABCDEFGHIJKLMNOPQRSTU";
+
+// Cases of the switch statements, in the format expected by the callback:
+// the number of cases, the bit width of the operand, and the case values.
+static uint64_t small_cases[2 + 4];
+static uint64_t large_cases[2 + 256];
+
+// A buffer in the data section of the program, providing distinct caller
+// addresses recognized as a part of the program image in calls to the hooks.
+static char fake_code[1 << 20];
+
+// Invokes a callback from the call site identified by kSite. The barrier after
+// the call prevents the compiler from turning it into a tail call, which would
+// make the return address the same for all sites.
+template <int kSite>
+NOINLINE void CallbackSite(Callback callback) {
+  switch (callback) {
+    case kCmp2:
+      __sanitizer_cov_trace_cmp2(static_cast<uint16_t>(kOperand),
+                                 static_cast<uint16_t>(kOperand));
+      break;
+    case kCmp4:
+      __sanitizer_cov_trace_cmp4(static_cast<uint32_t>(kOperand),
+                                 static_cast<uint32_t>(kOperand));
+      break;
+    case kCmp8:
+      __sanitizer_cov_trace_cmp8(kOperand, kOperand);
+      break;
+    case kConstCmp2:
+      __sanitizer_cov_trace_const_cmp2(static_cast<uint16_t>(kOperand),
+                                       static_cast<uint16_t>(kOperand));
+      break;
+    case kConstCmp4:
+      __sanitizer_cov_trace_const_cmp4(static_cast<uint32_t>(kOperand),
+                                       static_cast<uint32_t>(kOperand));
+      break;
+    case kConstCmp8:
+      __sanitizer_cov_trace_const_cmp8(kOperand, kOperand);
+      break;
+    case kSwitchSmall:
+      __sanitizer_cov_trace_switch(small_cases[2 + 3], small_cases);
+      break;
+    case kSwitchLarge:
+      __sanitizer_cov_trace_switch(large_cases[2 + 255], large_cases);
+      break;
+    case kMemcmp:
+      __sanitizer_weak_hook_memcmp(&fake_code[kSite], kString, kString,
+                                   sizeof(kString) - 1, 0);
+      break;
+    case kStrncmp:
+      __sanitizer_weak_hook_strncmp(&fake_code[kSite], kString, kString,
+                                    sizeof(kString) - 1, 0);
+      break;
+    case kStrcmp:
+      __sanitizer_weak_hook_strcmp(&fake_code[kSite], kString, kString, 0);
+      break;
+    default:
+      break;
+  }
+  COMPILER_BARRIER();
+}
+
+typedef void (*SiteFunction)(Callback);
+
+template <int... kSites>
+struct SiteTable {
+  static const SiteFunction sites[sizeof...(kSites)];
+};
+
+template <int... kSites>
+const SiteFunction SiteTable<kSites...>::sites[sizeof...(kSites)] = {
+  CallbackSite<kSites>...
+};
+
+template <int kOffset, int... kSites>
+static const SiteFunction *MakeSites(std::integer_sequence<int, kSites...>) {
+  return SiteTable<(kOffset + kSites)...>::sites;
+}
+
+static const SiteFunction *GetSites() {
+  return MakeSites<0>(std::make_integer_sequence<int, kSitesCount>());
+}
+
+static double NanosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Measures the average time of a call which finds new traces, by calling the
+// callback from all sites after resetting the traces found so far.
+static double MeasureCold(Callback callback, int rounds) {
+  const SiteFunction *sites = GetSites();
+  double total_ns = 0;
+  for (int round = 0; round < rounds; round++) {
+    cmpcov_reset();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSitesCount; i++) {
+      sites[i](callback);
+    }
+    total_ns += NanosecondsSince(start);
+  }
+  return total_ns / (static_cast<double>(rounds) * kSitesCount);
+}
+
+// Measures the average time of a call from a single site, which only finds
+// traces already recorded before.
+static double MeasureWarm(Callback callback, int iterations) {
+  const SiteFunction site = GetSites()[0];
+  site(callback);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    site(callback);
+  }
+  return NanosecondsSince(start) / iterations;
+}
+
+// Measures the throughput of the memcmp() hook called concurrently by
+// |threads_count| threads, in millions of calls per second. In the cold
+// scenario, every call is made from a different caller address.
+static double MeasureThreads(int threads_count, bool cold, int iterations) {
+  cmpcov_reset();
+
+  std::atomic<int> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threads_count; t++) {
+    threads.emplace_back([&, t]() {
+      const size_t stride = sizeof(fake_code) / threads_count;
+      char *pc = &fake_code[t * stride];
+
+      ready++;
+      while (!go) {
+        std::this_thread::yield();
+      }
+
+      for (int i = 0; i < iterations; i++) {
+        __sanitizer_weak_hook_memcmp(cold ? &pc[i % stride] : pc, kString,
+                                     kString, 8, 0);
+      }
+    });
+  }
+
+  while (ready != threads_count) {
+    std::this_thread::yield();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double elapsed_ns = NanosecondsSince(start);
+
+  return 1e3 * threads_count * iterations / elapsed_ns;
+}
+
+static void SetEnvironmentVariable(const char *name, const char *value) {
+#ifdef _WIN32
+  _putenv_s(name, value);
+#else
+  setenv(name, value, /*overwrite=*/1);
+#endif
+}
+
+// Runs the program itself with the specified mode and environment variables.
+static void RunChild(const char *program, const char *mode,
+                     const char *asan_options, const char *thread_local_mode) {
+  SetEnvironmentVariable("ASAN_OPTIONS", asan_options);
+  SetEnvironmentVariable("TRACE_NONCONST_CMP", "1");
+  SetEnvironmentVariable("CMPCOV_THREAD_LOCAL", thread_local_mode);
+
+  const std::string command = std::string("\"") + program + "\" " + mode;
+  fflush(stdout);
+  if (system(command.c_str()) != 0) {
+    fprintf(stderr, "Unable to run \"%s\".\n", command.c_str());
+    exit(1);
+  }
+}
+
+static void RunCallbacks(bool enabled) {
+  for (int i = 0; i < kCallbacksCount; i++) {
+    const Callback callback = static_cast<Callback>(i);
+    if (enabled) {
+      printf("%-26s %10.1f %10.1f\n", kCallbackNames[i],
+             MeasureCold(callback, /*rounds=*/200),
+             MeasureWarm(callback, /*iterations=*/2000000));
+    } else {
+      printf("%-26s %10.1f\n", kCallbackNames[i],
+             MeasureWarm(callback, /*iterations=*/2000000));
+    }
+  }
+}
+
+static void RunThreads() {
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    printf("%-26d %10.1f %10.1f\n", threads,
+           MeasureThreads(threads, /*cold=*/true, /*iterations=*/100000),
+           MeasureThreads(threads, /*cold=*/false, /*iterations=*/1000000));
+  }
+}
+
+int main(int argc, char **argv) {
+  small_cases[0] = 4;
+  small_cases[1] = 64;
+  for (int i = 0; i < 4; i++) {
+    small_cases[2 + i] = kOperand + i;
+  }
+  large_cases[0] = 256;
+  large_cases[1] = 64;
+  for (int i = 0; i < 256; i++) {
+    large_cases[2 + i] = kOperand + i;
+  }
+
+  if (argc == 2 && !strcmp(argv[1], "callbacks")) {
+    RunCallbacks(/*enabled=*/true);
+  } else if (argc == 2 && !strcmp(argv[1], "disabled")) {
+    RunCallbacks(/*enabled=*/false);
+  } else if (argc == 2 && !strcmp(argv[1], "threads")) {
+    RunThreads();
+  } else if (argc == 1) {
+    printf("%-26s %10s %10s\n", "callback [ns/call]", "cold", "warm");
+    RunChild(argv[0], "callbacks", "coverage=1", "0");
+    printf("\n%-26s %10s\n", "callback [ns/call]", "disabled");
+    RunChild(argv[0], "disabled", "coverage=0", "0");
+    printf("\n%-26s %10s %10s\n", "threads [Mcalls/s]", "cold", "warm");
+    RunChild(argv[0], "threads", "coverage=1", "0");
+    printf("\n%-26s %10s %10s\n", "threads, local [Mcalls/s]", "cold", "warm");
+    RunChild(argv[0], "threads", "coverage=1", "1");
+  } else {
+    fprintf(stderr, "Usage: %s [callbacks|disabled|threads]\n", argv[0]);
+    return 1;
+  }
+
+  // Discard the traces, so that no output files are written at exit.
+  cmpcov_reset();
+  return 0;
+}
@@ -0,0 +1,637 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// A command-line tool processing large numbers of .sancov files written by
+// cmpcov and SanitizerCoverage, e.g. to distill a fuzzing corpus. It supports
+// two commands:
+//
+// merge    - writes the union of the traces of all input files to a single
+//            file per module,
+// minimize - selects a subset of the samples of a corpus which covers all of
+//            its traces, using the greedy set cover algorithm.
+//
+// Both the comparison (cmp.<module>.<id>.sancov) and the edge coverage files
+// (<module>.<id>.sancov) are accepted, in the standard or the compact format
+// (see compact_format.h) and of either bitness. The traces of a module are
+// identified by the file name without the <id> component, so the cmp and edge
+// traces of a module are kept apart. The files are memory-mapped and decoded
+// by several threads at once.
+//
+// The inputs of merge are .sancov files or directories containing them. The
+// inputs of minimize are directories, each holding the .sancov files of a
+// single sample. In both cases, an argument starting with '@' is replaced by
+// the paths listed in the specified file, one per line.
+//
+// For minimization, every distinct trace of the corpus is assigned a dense
+// 32-bit index, and each sample is represented by the sorted list of indexes of
+// its traces, built in a second pass over the files to keep the memory usage
+// proportional to the sizes of the samples. The traces covered so far are kept
+// in a bitset, and the samples are selected greedily by the number of new
+// traces, which is re-evaluated lazily as the samples leave a priority queue.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "../source/common.h"
+#include "../source/compact_format.h"
+#include "../source/file_view.h"
+
+#ifdef _WIN32
+static const char kPathSeparator = '\\';
+#else
+static const char kPathSeparator = '/';
+#endif
+
+static const char kSancovSuffix[] = ".sancov";
+
+// The number of traces a worker thread collects for a module before removing
+// the duplicates, which bounds the memory used by repeated traces.
+static const size_t kDeduplicationThreshold = 1 << 20;
+
+static bool EndsWith(const std::string& s, const char *suffix) {
+  const size_t length = strlen(suffix);
+  return s.size() >= length &&
+         s.compare(s.size() - length, length, suffix) == 0;
+}
+
+// Extracts the module key from the path of a <module>.<id>.sancov file, i.e.
+// the file name without the <id> component and the extension. The key of the
+// comparison files includes the cmp. prefix. Returns false if the file isn't
+// named accordingly.
+static bool GetModuleKey(const std::string& path, std::string *key) {
+  std::string name = path;
+  const size_t separator = name.find_last_of("/\\");
+  if (separator != std::string::npos) {
+    name = name.substr(separator + 1);
+  }
+
+  if (!EndsWith(name, kSancovSuffix)) {
+    return false;
+  }
+  name.resize(name.size() - strlen(kSancovSuffix));
+
+  const size_t dot = name.find_last_of('.');
+  if (dot == std::string::npos || dot == 0) {
+    return false;
+  }
+  *key = name.substr(0, dot);
+  return true;
+}
+
+static bool IsDirectory(const std::string& path) {
+#ifdef _WIN32
+  const DWORD attributes = GetFileAttributesA(path.c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES &&
+         (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// Appends the paths of the .sancov files found in |directory| to |paths|.
+static void ListSancovFiles(const std::string& directory,
+                            std::vector<std::string> *paths) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA find_data;
+  HANDLE find = FindFirstFileA((directory + "\\*.sancov").c_str(),
+                               &find_data);
+  if (find == INVALID_HANDLE_VALUE) {
+    if (GetLastError() != ERROR_FILE_NOT_FOUND) {
+      Die("[-] Unable to list the \"%s\" directory.\n", directory.c_str());
+    }
+    return;
+  }
+  do {
+    if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+      paths->push_back(directory + kPathSeparator + find_data.cFileName);
+    }
+  } while (FindNextFileA(find, &find_data));
+  FindClose(find);
+#else
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL) {
+    Die("[-] Unable to list the \"%s\" directory.\n", directory.c_str());
+  }
+  while (struct dirent *entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (EndsWith(name, kSancovSuffix) && entry->d_type != DT_DIR) {
+      paths->push_back(directory + kPathSeparator + name);
+    }
+  }
+  closedir(dir);
+#endif
+}
+
+// Reads the traces from the .sancov file at |path| and stores their width in
+// bits in |width|. Zero entries, found at the end of the memory-mapped output
+// files of abnormally terminated runs, are skipped, and so are empty files.
+// Kills the process on failure.
+static void ReadSancovFile(const std::string& path, int *width,
+                           std::vector<uint64_t> *traces) {
+  FileView file(path.c_str());
+  if (file.size() == 0) {
+    *width = 0;
+    return;
+  }
+
+  uint64_t magic = 0;
+  if (file.size() >= sizeof(magic)) {
+    memcpy(&magic, file.data(), sizeof(magic));
+  }
+
+  if (magic == kMagic64 || magic == kMagic32) {
+    *width = (magic == kMagic64) ? 64 : 32;
+    const size_t entry_size = *width / 8;
+    const uint8_t *data = file.data() + sizeof(magic);
+    const size_t count = (file.size() - sizeof(magic)) / entry_size;
+    traces->reserve(traces->size() + count);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t trace = 0;
+      if (entry_size == sizeof(uint64_t)) {
+        memcpy(&trace, data + i * entry_size, sizeof(uint64_t));
+      } else {
+        uint32_t trace32;
+        memcpy(&trace32, data + i * entry_size, sizeof(uint32_t));
+        trace = trace32;
+      }
+      if (trace != 0) {
+        traces->push_back(trace);
+      }
+    }
+  } else if (DecodeCompactTraces64(file.data(), file.size(), &magic, traces)) {
+    *width = (magic == kCompactMagic64) ? 64 : 32;
+  } else if (magic == kCompactMagic64 || magic == kCompactMagic32) {
+    Die("[-] The \"%s\" file is malformed.\n", path.c_str());
+  } else {
+    Die("[-] The \"%s\" file has an unknown format.\n", path.c_str());
+  }
+}
+
+// Writes the traces of a module to |path|, in the standard or the compact
+// format. The traces must be sorted.
+static void WriteSancovFile(const std::string& path, int width, bool compact,
+                            std::vector<uint64_t> *traces) {
+  std::vector<uint8_t> output;
+  if (compact) {
+    EncodeCompactTraces64(width == 64 ? kCompactMagic64 : kCompactMagic32,
+                          traces, &output);
+  } else {
+    const uint64_t magic = (width == 64) ? kMagic64 : kMagic32;
+    const size_t entry_size = width / 8;
+    output.resize(sizeof(magic) + traces->size() * entry_size);
+    memcpy(&output[0], &magic, sizeof(magic));
+    for (size_t i = 0; i < traces->size(); i++) {
+      uint8_t *entry = &output[sizeof(magic) + i * entry_size];
+      if (entry_size == sizeof(uint64_t)) {
+        memcpy(entry, &(*traces)[i], sizeof(uint64_t));
+      } else {
+        const uint32_t trace32 = static_cast<uint32_t>((*traces)[i]);
+        memcpy(entry, &trace32, sizeof(uint32_t));
+      }
+    }
+  }
+  WriteFileOrDie(path.c_str(), output.data(), output.size(), /*append=*/false);
+}
+
+static void SortAndDeduplicate(std::vector<uint64_t> *traces) {
+  std::sort(traces->begin(), traces->end());
+  traces->erase(std::unique(traces->begin(), traces->end()), traces->end());
+}
+
+// Calls |callback| for all indexes in [0, count) from |threads| threads. The
+// second argument of the callback is the number of the calling thread.
+static void ParallelFor(size_t count, int threads,
+                        const std::function<void(size_t, int)>& callback) {
+  std::atomic<size_t> next_index(0);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&, i]() {
+      for (size_t idx = next_index++; idx < count; idx = next_index++) {
+        callback(idx, i);
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+// Reads the paths listed in the file at |path|, one per line.
+static void ReadPathList(const std::string& path,
+                         std::vector<std::string> *paths) {
+  FileView file(path.c_str());
+  const char *data = reinterpret_cast<const char *>(file.data());
+  size_t start = 0;
+  while (start < file.size()) {
+    size_t end = start;
+    while (end < file.size() && data[end] != '\n') {
+      end++;
+    }
+    std::string line(data + start, end - start);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      paths->push_back(line);
+    }
+    start = end + 1;
+  }
+}
+
+// Collects the input paths from the command line, expanding the @lists.
+static std::vector<std::string> GetInputPaths(int argc, char **argv) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < argc; i++) {
+    if (argv[i][0] == '@') {
+      ReadPathList(argv[i] + 1, &paths);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  return paths;
+}
+
+// The modules found in the input files, shared by the worker threads.
+class ModuleRegistry {
+ public:
+  // Returns the ID of the module with the specified key and width of traces,
+  // registering it if it's seen for the first time. Kills the process if the
+  // module was previously found with a different width.
+  int GetModuleId(const std::string& key, int width, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = ids_.find(key);
+    if (it != ids_.end()) {
+      if (widths_[it->second] != width) {
+        Die("[-] The \"%s\" file has a different bitness than the other files "
+            "of the module.\n", path.c_str());
+      }
+      return it->second;
+    }
+
+    const int id = static_cast<int>(keys_.size());
+    ids_[key] = id;
+    keys_.push_back(key);
+    widths_.push_back(width);
+    return id;
+  }
+
+  // The accessors may only be used once no more modules are registered.
+  size_t size() const { return keys_.size(); }
+  const std::string& key(int id) const { return keys_[id]; }
+  int width(int id) const { return widths_[id]; }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, int> ids_;
+  std::vector<std::string> keys_;
+  std::vector<int> widths_;
+};
+
+// The traces of all modules collected by a single worker thread.
+class TraceCollector {
+ public:
+  void Add(int module_id, const std::vector<uint64_t>& traces) {
+    if (module_id >= static_cast<int>(traces_.size())) {
+      traces_.resize(module_id + 1);
+      deduplicated_sizes_.resize(module_id + 1);
+    }
+
+    std::vector<uint64_t>& module_traces = traces_[module_id];
+    module_traces.insert(module_traces.end(), traces.begin(), traces.end());
+    if (module_traces.size() - deduplicated_sizes_[module_id] >=
+        kDeduplicationThreshold) {
+      SortAndDeduplicate(&module_traces);
+      deduplicated_sizes_[module_id] = module_traces.size();
+    }
+  }
+
+  // Moves the traces of the module out of the collector.
+  void Take(int module_id, std::vector<uint64_t> *traces) {
+    if (module_id < static_cast<int>(traces_.size())) {
+      traces->insert(traces->end(), traces_[module_id].begin(),
+                     traces_[module_id].end());
+      std::vector<uint64_t>().swap(traces_[module_id]);
+    }
+  }
+
+ private:
+  std::vector<std::vector<uint64_t>> traces_;
+  std::vector<size_t> deduplicated_sizes_;
+};
+
+// Combines the traces of the collectors into a sorted set of traces for each
+// module.
+static std::vector<std::vector<uint64_t>> CombineCollectors(
+    std::vector<TraceCollector> *collectors, size_t modules_count,
+    int threads) {
+  std::vector<std::vector<uint64_t>> traces(modules_count);
+  ParallelFor(modules_count, threads, [&](size_t module_id, int) {
+    for (TraceCollector& collector : *collectors) {
+      collector.Take(static_cast<int>(module_id), &traces[module_id]);
+    }
+    SortAndDeduplicate(&traces[module_id]);
+  });
+  return traces;
+}
+
+// Reads the .sancov file at |path|, registers its module, and stores the ID of
+// the module. Returns false if the file is empty.
+static bool ReadModuleFile(const std::string& path, ModuleRegistry *modules,
+                           int *module_id, std::vector<uint64_t> *traces) {
+  std::string key;
+  if (!GetModuleKey(path, &key)) {
+    Die("[-] The \"%s\" file isn't named <module>.<id>.sancov.\n",
+        path.c_str());
+  }
+
+  int width;
+  ReadSancovFile(path, &width, traces);
+  if (width == 0) {
+    return false;
+  }
+  *module_id = modules->GetModuleId(key, width, path);
+  return true;
+}
+
+static int Merge(const std::string& output_directory,
+                 const std::vector<std::string>& inputs, int threads,
+                 bool compact) {
+  if (!IsDirectory(output_directory)) {
+    Die("[-] The \"%s\" output directory doesn't exist.\n",
+        output_directory.c_str());
+  }
+
+  std::vector<std::string> paths;
+  for (const std::string& input : inputs) {
+    if (IsDirectory(input)) {
+      ListSancovFiles(input, &paths);
+    } else {
+      paths.push_back(input);
+    }
+  }
+
+  ModuleRegistry modules;
+  std::vector<TraceCollector> collectors(threads);
+  ParallelFor(paths.size(), threads, [&](size_t idx, int thread) {
+    std::vector<uint64_t> traces;
+    int module_id;
+    if (ReadModuleFile(paths[idx], &modules, &module_id, &traces)) {
+      collectors[thread].Add(module_id, traces);
+    }
+  });
+
+  std::vector<std::vector<uint64_t>> traces =
+      CombineCollectors(&collectors, modules.size(), threads);
+
+  size_t traces_count = 0;
+  for (size_t i = 0; i < modules.size(); i++) {
+    const std::string path = output_directory + kPathSeparator +
+                             modules.key(i) + ".merged" + kSancovSuffix;
+    WriteSancovFile(path, modules.width(i), compact, &traces[i]);
+    traces_count += traces[i].size();
+  }
+
+  fprintf(stderr, "[+] Merged %zu files into %zu modules with %zu traces.\n",
+          paths.size(), modules.size(), traces_count);
+  return 0;
+}
+
+// A sample of the corpus considered during minimization.
+struct Sample {
+  // The .sancov files of the sample, and the IDs of their modules.
+  std::vector<std::string> paths;
+  std::vector<int> module_ids;
+
+  // The sorted indexes of the traces of the sample.
+  std::vector<uint32_t> traces;
+};
+
+// A candidate sample in the priority queue, ordered by the number of new traces
+// it was last known to cover, and by the order on the command line.
+struct Candidate {
+  size_t gain;
+  size_t sample_idx;
+
+  bool operator<(const Candidate& other) const {
+    if (gain != other.gain) {
+      return gain < other.gain;
+    }
+    return sample_idx > other.sample_idx;
+  }
+};
+
+static size_t CountUncovered(const std::vector<uint32_t>& traces,
+                             const std::vector<uint64_t>& covered) {
+  size_t count = 0;
+  for (uint32_t idx : traces) {
+    count += ((covered[idx / 64] >> (idx % 64)) & 1) ^ 1;
+  }
+  return count;
+}
+
+static int Minimize(const std::vector<std::string>& inputs, int threads,
+                    FILE *output) {
+  std::vector<Sample> samples(inputs.size());
+
+  // In the first pass, find the distinct traces of every module.
+  ModuleRegistry modules;
+  std::vector<TraceCollector> collectors(threads);
+  ParallelFor(samples.size(), threads, [&](size_t idx, int thread) {
+    Sample& sample = samples[idx];
+    std::vector<std::string> paths;
+    ListSancovFiles(inputs[idx], &paths);
+
+    std::vector<uint64_t> traces;
+    for (const std::string& path : paths) {
+      int module_id;
+      traces.clear();
+      if (ReadModuleFile(path, &modules, &module_id, &traces)) {
+        collectors[thread].Add(module_id, traces);
+        sample.paths.push_back(path);
+        sample.module_ids.push_back(module_id);
+      }
+    }
+  });
+
+  const std::vector<std::vector<uint64_t>> universe =
+      CombineCollectors(&collectors, modules.size(), threads);
+  collectors.clear();
+
+  // Assign consecutive ranges of indexes to the traces of every module.
+  std::vector<size_t> first_index(modules.size());
+  size_t universe_size = 0;
+  for (size_t i = 0; i < modules.size(); i++) {
+    first_index[i] = universe_size;
+    universe_size += universe[i].size();
+  }
+  if (universe_size > UINT32_MAX) {
+    Die("[-] The corpus has too many distinct traces (%zu).\n", universe_size);
+  }
+
+  // In the second pass, translate the traces of the samples into indexes.
+  ParallelFor(samples.size(), threads, [&](size_t idx, int) {
+    Sample& sample = samples[idx];
+    std::vector<uint64_t> traces;
+    for (size_t i = 0; i < sample.paths.size(); i++) {
+      const int module_id = sample.module_ids[i];
+      const std::vector<uint64_t>& module_universe = universe[module_id];
+      int width;
+      traces.clear();
+      ReadSancovFile(sample.paths[i], &width, &traces);
+      for (uint64_t trace : traces) {
+        const size_t position =
+            std::lower_bound(module_universe.begin(), module_universe.end(),
+                             trace) - module_universe.begin();
+        sample.traces.push_back(
+            static_cast<uint32_t>(first_index[module_id] + position));
+      }
+    }
+
+    std::sort(sample.traces.begin(), sample.traces.end());
+    sample.traces.erase(
+        std::unique(sample.traces.begin(), sample.traces.end()),
+        sample.traces.end());
+    sample.traces.shrink_to_fit();
+    std::vector<std::string>().swap(sample.paths);
+    std::vector<int>().swap(sample.module_ids);
+  });
+
+  // Greedily select the sample with the most uncovered traces, until all the
+  // traces are covered. The gains can only decrease as more traces get
+  // covered, so a sample whose recomputed gain is still the highest in the
+  // queue is guaranteed to be the best choice.
+  std::priority_queue<Candidate> queue;
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (!samples[i].traces.empty()) {
+      queue.push({samples[i].traces.size(), i});
+    }
+  }
+
+  std::vector<uint64_t> covered((universe_size + 63) / 64);
+  size_t selected_count = 0;
+  while (!queue.empty()) {
+    Candidate candidate = queue.top();
+    queue.pop();
+
+    const std::vector<uint32_t>& traces = samples[candidate.sample_idx].traces;
+    const size_t gain = CountUncovered(traces, covered);
+    if (gain == 0) {
+      continue;
+    } else if (gain < candidate.gain) {
+      queue.push({gain, candidate.sample_idx});
+      continue;
+    }
+
+    for (uint32_t idx : traces) {
+      covered[idx / 64] |= 1ULL << (idx % 64);
+    }
+    fprintf(output, "%s\n", inputs[candidate.sample_idx].c_str());
+    selected_count++;
+  }
+
+  fprintf(stderr, "[+] Selected %zu out of %zu samples, covering %zu traces "
+          "in %zu modules.\n", selected_count, samples.size(), universe_size,
+          modules.size());
+  return 0;
+}
+
+static void PrintUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s merge [-j threads] [-c] <output directory> <inputs...>\n"
+          "       %s minimize [-j threads] [-o output list] <inputs...>\n"
+          "\n"
+          "  -j  number of worker threads (default: number of CPUs)\n"
+          "  -c  write the merged files in the compact format\n"
+          "  -o  write the selected samples to a file instead of stdout\n"
+          "\n"
+          "An input starting with '@' names a file listing the inputs.\n",
+          program, program);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const std::string command = argv[1];
+  int threads = static_cast<int>(std::thread::hardware_concurrency());
+  bool compact = false;
+  const char *output_path = nullptr;
+
+  int arg = 2;
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (!strcmp(argv[arg], "-c")) {
+      compact = true;
+    } else if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+      threads = atoi(argv[++arg]);
+    } else if (!strcmp(argv[arg], "-o") && arg + 1 < argc) {
+      output_path = argv[++arg];
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (threads <= 0) {
+    threads = 1;
+  }
+
+  if (command == "merge" && output_path == nullptr && argc - arg >= 2) {
+    return Merge(argv[arg], GetInputPaths(argc - arg - 1, argv + arg + 1),
+                 threads, compact);
+  } else if (command == "minimize" && !compact && argc - arg >= 1) {
+    FILE *output = stdout;
+    if (output_path != nullptr) {
+      output = fopen(output_path, "w");
+      if (output == NULL) {
+        Die("[-] Unable to open the \"%s\" file for writing.\n", output_path);
+      }
+    }
+    const int result = Minimize(GetInputPaths(argc - arg, argv + arg), threads,
+                                output);
+    fclose(output);
+    return result;
+  }
+
+  PrintUsage(argv[0]);
+  return 1;
+}
@@ -0,0 +1,151 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <mutex>
+
+#include "common.h"
+
+// Blocks are served from pools of sizes 2^kMinPoolBits to 2^kMaxPoolBits.
+static const int kMinPoolBits = 4;
+static const int kMaxPoolBits = 20;
+static const int kPoolsCount = kMaxPoolBits - kMinPoolBits + 1;
+
+// The size of the regions which the pools are carved out of.
+static const size_t kRegionSize = 16 * 1024 * 1024;
+
+namespace arena {
+
+// A released block, linked into the list of free blocks of its pool.
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+// The arena state is statically initialized, so that it can be used before any
+// constructors run.
+static std::mutex mutex;
+static FreeBlock *free_lists[kPoolsCount];
+static uint8_t *region_cursor;
+static uint8_t *region_end;
+
+}  // namespace arena
+
+static void *MapMemory(size_t size) {
+#ifdef _WIN32
+  void *ptr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+                           PAGE_READWRITE);
+  if (ptr == NULL) {
+    Die("[-] Unable to allocate %zu bytes of arena memory.\n", size);
+  }
+#else
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    Die("[-] Unable to allocate %zu bytes of arena memory.\n", size);
+  }
+#endif
+  return ptr;
+}
+
+static void UnmapMemory(void *ptr, size_t size) {
+#ifdef _WIN32
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+  munmap(ptr, size);
+#endif
+}
+
+// Returns the index of the smallest pool with blocks of at least |size| bytes.
+static int GetPoolIndex(size_t size) {
+  int bits = kMinPoolBits;
+  while ((static_cast<size_t>(1) << bits) < size) {
+    bits++;
+  }
+  return bits - kMinPoolBits;
+}
+
+// Page-aligned size of a block mapped individually.
+static size_t GetMappedSize(size_t size) {
+  const size_t kPageSize = 4096;
+  return (size + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+void *ArenaAllocate(size_t size) {
+  if (size == 0) {
+    size = 1;
+  }
+  if (size > (static_cast<size_t>(1) << kMaxPoolBits)) {
+    return MapMemory(GetMappedSize(size));
+  }
+
+  const int pool = GetPoolIndex(size);
+  const size_t block_size = static_cast<size_t>(1) << (pool + kMinPoolBits);
+
+  std::lock_guard<std::mutex> lock(arena::mutex);
+  arena::FreeBlock *block = arena::free_lists[pool];
+  if (block != nullptr) {
+    arena::free_lists[pool] = block->next;
+    return block;
+  }
+
+  // The remainder of a region too small for the block is abandoned.
+  if (static_cast<size_t>(arena::region_end - arena::region_cursor) <
+      block_size) {
+    arena::region_cursor = static_cast<uint8_t *>(MapMemory(kRegionSize));
+    arena::region_end = arena::region_cursor + kRegionSize;
+  }
+
+  void *ptr = arena::region_cursor;
+  arena::region_cursor += block_size;
+  return ptr;
+}
+
+void ArenaFree(void *ptr, size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (size == 0) {
+    size = 1;
+  }
+  if (size > (static_cast<size_t>(1) << kMaxPoolBits)) {
+    UnmapMemory(ptr, GetMappedSize(size));
+    return;
+  }
+
+  const int pool = GetPoolIndex(size);
+  arena::FreeBlock *block = static_cast<arena::FreeBlock *>(ptr);
+
+  std::lock_guard<std::mutex> lock(arena::mutex);
+  block->next = arena::free_lists[pool];
+  arena::free_lists[pool] = block;
+}
+
+void LockArena() {
+  arena::mutex.lock();
+}
+
+void UnlockArena() {
+  arena::mutex.unlock();
+}
@@ -0,0 +1,112 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A private memory arena for the internal data structures of cmpcov. The
+// callbacks may run inside of the sanitizer runtime, in signal handlers, or in
+// the middle of the target's own allocations, so the containers which grow on
+// the hot path (trace tables and lists, module lists, per-thread state) should
+// never enter the global (sanitized) allocator. Instead, they draw from pools
+// of free blocks of power-of-two sizes, carved out of large regions mapped
+// directly from the operating system. Blocks above the largest pool size are
+// mapped and unmapped individually.
+//
+// The arena is thread-safe, and its memory is never returned to the operating
+// system, except for the individually mapped blocks. ArenaAllocator is a
+// standard-compatible allocator for using the arena in STL containers.
+
+#ifndef CMPCOV_ARENA_H_
+#define CMPCOV_ARENA_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Returns a block of at least |size| bytes, aligned to 16 bytes. Kills the
+// process if the memory can't be mapped.
+void *ArenaAllocate(size_t size);
+
+// Releases a block previously returned by ArenaAllocate for the same |size|.
+void ArenaFree(void *ptr, size_t size);
+
+// Acquires and releases the lock of the arena, so that no other thread can be
+// in the middle of an allocation while the process forks.
+void LockArena();
+void UnlockArena();
+
+// Creates and destroys objects in the arena.
+template <typename T, typename... Args>
+T *ArenaNew(Args&&... args) {
+  return new (ArenaAllocate(sizeof(T))) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void ArenaDelete(T *ptr) {
+  if (ptr != nullptr) {
+    ptr->~T();
+    ArenaFree(ptr, sizeof(T));
+  }
+}
+
+// A deleter for std::unique_ptr holding objects created with ArenaNew.
+template <typename T>
+struct ArenaDeleter {
+  void operator()(T *ptr) const { ArenaDelete(ptr); }
+};
+
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  ArenaAllocator() = default;
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>&) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(ArenaAllocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    ArenaFree(ptr, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+using ArenaString =
+    std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+template <typename K, typename V, typename Hash = std::hash<K>>
+using ArenaUnorderedMap =
+    std::unordered_map<K, V, Hash, std::equal_to<K>,
+                       ArenaAllocator<std::pair<const K, V>>>;
+
+#endif  // CMPCOV_ARENA_H_
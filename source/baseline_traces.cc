@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "baseline_traces.h"
+
+#include <cstring>
+
+#include "common.h"
+#include "compact_format.h"
+#include "file_view.h"
+
+// The expected number of traces per module, used to preallocate the tables.
+static const size_t kInitialTableCapacity = 4096;
+
+// Extracts the module name from the path of a cmp.<module>.<id>.sancov file.
+// Returns false if the file isn't named accordingly.
+static bool GetModuleNameFromPath(const char *path, std::string *module_name) {
+  std::string name = path;
+  const size_t separator = name.find_last_of("/\\");
+  if (separator != std::string::npos) {
+    name = name.substr(separator + 1);
+  }
+
+  const std::string kPrefix = "cmp.";
+  const std::string kSuffix = ".sancov";
+  if (name.size() <= kPrefix.size() + kSuffix.size() ||
+      name.compare(0, kPrefix.size(), kPrefix) != 0 ||
+      name.compare(name.size() - kSuffix.size(), kSuffix.size(),
+                   kSuffix) != 0) {
+    return false;
+  }
+  name = name.substr(kPrefix.size(),
+                     name.size() - kPrefix.size() - kSuffix.size());
+
+  // Drop the <id> component.
+  const size_t dot = name.find_last_of('.');
+  if (dot == std::string::npos || dot == 0) {
+    return false;
+  }
+  *module_name = name.substr(0, dot);
+  return true;
+}
+
+void BaselineTraces::Load(const char *path) {
+  std::string module_name;
+  if (!GetModuleNameFromPath(path, &module_name)) {
+    Die("[-] The \"%s\" baseline file isn't named cmp.<module>.<id>.sancov.\n",
+        path);
+  }
+  TraceTable *table = tables_[GetOrAddModule(module_name)].get();
+
+  FileView file(path);
+  uint64_t magic = 0;
+  if (file.size() >= sizeof(magic)) {
+    memcpy(&magic, file.data(), sizeof(magic));
+  }
+
+  if (magic == kMagic) {
+    // The standard format is a plain array of traces following the magic.
+    const uint8_t *data = file.data() + sizeof(kMagic);
+    const size_t count = (file.size() - sizeof(kMagic)) / sizeof(size_t);
+    for (size_t i = 0; i < count; i++) {
+      size_t trace;
+      memcpy(&trace, data + i * sizeof(size_t), sizeof(size_t));
+      table->Insert(trace);
+    }
+  } else if (magic == kCompactMagic) {
+    ArenaVector<size_t> traces;
+    if (!DecodeCompactTraces(file.data(), file.size(), &traces)) {
+      Die("[-] The \"%s\" baseline file is malformed.\n", path);
+    }
+    for (size_t trace : traces) {
+      table->Insert(trace);
+    }
+  } else {
+    Die("[-] The \"%s\" baseline file has an unknown format or bitness.\n",
+        path);
+  }
+}
+
+int BaselineTraces::FindModule(const char *module_name) const {
+  for (size_t i = 0; i < module_names_.size(); i++) {
+    if (module_names_[i] == module_name) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+size_t BaselineTraces::size() const {
+  size_t total = 0;
+  for (const auto& table : tables_) {
+    total += table->size();
+  }
+  return total;
+}
+
+int BaselineTraces::GetOrAddModule(const std::string& module_name) {
+  const int idx = FindModule(module_name.c_str());
+  if (idx != -1) {
+    return idx;
+  }
+
+  module_names_.push_back(module_name);
+  tables_.push_back(std::make_unique<TraceTable>(kInitialTableCapacity));
+  return static_cast<int>(tables_.size() - 1);
+}
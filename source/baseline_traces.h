@@ -0,0 +1,74 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A set of traces which are already known to the consumer of the coverage,
+// e.g. the union of the traces of the whole fuzzing corpus. Traces found in
+// the baseline are treated as already seen, so that the output of an execution
+// only contains the traces which are new, and an execution without any new
+// traces doesn't produce any output files at all.
+//
+// The baseline is loaded from .sancov files in either the standard or the
+// compact format (see compact_format.h), named the same way as the output
+// files, i.e. cmp.<module>.<id>.sancov, where <id> is arbitrary (e.g. a PID).
+// The module name derived from the file name determines which module the
+// traces belong to. The traces of every module are kept in a separate hash
+// table, which is only read after initialization.
+
+#ifndef CMPCOV_BASELINE_TRACES_H_
+#define CMPCOV_BASELINE_TRACES_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "trace_table.h"
+
+class BaselineTraces {
+ public:
+  // Loads the traces from the .sancov file at |path|, adding them to the traces
+  // already loaded for the same module. Kills the process on failure.
+  void Load(const char *path);
+
+  // Returns the index of the baseline of the module with the specified name,
+  // or -1 if there is no baseline for the module.
+  int FindModule(const char *module_name) const;
+
+  // Checks if the output trace of a module (see Traces::ConstructOutputTrace)
+  // is in the baseline identified by |baseline_index|.
+  bool Contains(int baseline_index, size_t output_trace) const {
+    return tables_[baseline_index]->Contains(output_trace);
+  }
+
+  // Returns the total number of traces loaded from all files.
+  size_t size() const;
+
+ private:
+  // Returns the index of the baseline of the module, creating an empty one if
+  // it doesn't exist yet.
+  int GetOrAddModule(const std::string& module_name);
+
+  std::vector<std::string> module_names_;
+  std::vector<std::unique_ptr<TraceTable>> tables_;
+};
+
+#endif  // CMPCOV_BASELINE_TRACES_H_
@@ -46,6 +46,12 @@
 //
 // and link this library into it.
 //
+// If the library is built with -DCMPCOV_TRACE_PC_GUARD, it also implements the
+// trace-pc-guard callbacks in place of SanitizerCoverage, and records the
+// executed edges together with the comparison traces (as traces with argument
+// #1 set to kEdgeTraceArg1), so that all of the coverage is saved to a single
+// output.
+//
 // Runtime configuration
 // =====================
 //
@@ -62,23 +68,120 @@
 // TRACE_MEMORY_CMP   - enables the tracing of memcmp(), strcmp() and similar
 //                      functions.
 //
+// TRACE_LONG_CMP_LENGTH - enables the tracing of memory comparisons longer
+//                         than 32 bytes, up to the given length, at coarse
+//                         progress milestones.
+//
+// TRACE_SAMPLING_THRESHOLD - starts skipping the executions of comparisons
+//                            with an exponential back-off after they are
+//                            executed the given number of times without
+//                            progress. See site_throttle.h for details.
+//
+// CMPCOV_THREAD_LOCAL - records traces in per-thread buffers instead of a
+//                       single global container guarded by a mutex.
+//
+// CMPCOV_TABLE_CAPACITY - the number of unique traces for which the
+//                         deduplication tables are preallocated.
+//
+// CMPCOV_MEMORY_LIMIT_MB - the approximate limit of the memory used to store
+//                          the traces, after which no new traces are recorded.
+//
+// CMPCOV_SHM_ID - saves traces to a shared memory region identified by a SysV
+//                 shared memory ID (Linux) or a file mapping name (Windows),
+//                 instead of .sancov files. See shared_traces.h for details.
+//
+// CMPCOV_FLUSH_INTERVAL_MS - periodically appends the new traces to the .sancov
+//                            files from a background thread, for processes
+//                            which never exit cleanly.
+//
+// CMPCOV_MAPPED_OUTPUT - saves the traces to memory-mapped .sancov files as
+//                        they are found, so that they survive crashes. See
+//                        mapped_traces.h for details.
+//
+// CMPCOV_COMPACT_OUTPUT - writes the .sancov files at exit in a compact, sorted
+//                         and delta-encoded format. See compact_format.h for
+//                         details.
+//
+// CMPCOV_FORK_SERVER - prepares the process to be used as a fork server, so
+//                      that every forked child starts with an empty trace
+//                      state at a minimal cost (Linux only).
+//
+// CMPCOV_STATS - collects internal statistics and reports them at exit, either
+//                on stderr (CMPCOV_STATS=1) or in a JSON file in the coverage
+//                directory (CMPCOV_STATS=json).
+//
+// CMPCOV_PROFILE - counts the executions of every comparison site, and saves
+//                  the given number of the most frequently executed ones to a
+//                  text file in the coverage directory at exit.
+//
+// CMPCOV_DENYLIST - a file with a list of comparison sites which are never
+//                   instrumented, in the format written by CMPCOV_PROFILE. See
+//                   site_denylist.h for details.
+//
+// CMPCOV_INCLUDE_MODULES - a comma-separated list of the names of modules in
+//                          which comparisons are traced, ignoring all others.
+//
+// CMPCOV_EXCLUDE_MODULES - a comma-separated list of the names of modules in
+//                          which comparisons are not traced.
+//
+// CMPCOV_BASELINE - a comma-separated list of .sancov files with traces which
+//                   are treated as already seen and never saved. See
+//                   baseline_traces.h for details.
+//
+// CMPCOV_DICTIONARY - records up to the given number of distinct constant
+//                     operands of comparisons, and saves them to a dictionary
+//                     file in the coverage directory at exit.
+//
+// CMPCOV_HOST_TABLE_ID - deduplicates the traces across all processes on the
+//                        host in a table kept in a shared memory region, so
+//                        that only the traces new to the host are saved. See
+//                        host_trace_table.h for details.
+//
 
 #ifdef _WIN32
 #include <windows.h>
 #include <psapi.h>
 #elif __linux__
+#include <pthread.h>
 #include <unistd.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 
+#include "arena.h"
+#include "baseline_traces.h"
+#include "cmpcov.h"
 #include "common.h"
+#include "compact_format.h"
+#include "host_trace_table.h"
+#include "mapped_traces.h"
+#include "module_filter.h"
 #include "modules.h"
+#include "operand_dictionary.h"
+#include "saturation_cache.h"
+#include "site_denylist.h"
+#include "site_profile.h"
+#include "site_throttle.h"
+#include "stats.h"
+#include "switch_cache.h"
+#include "thread_traces.h"
 #include "tokenizer.h"
 #include "traces.h"
 
@@ -94,6 +197,13 @@
 #error Unsupported operating system.
 #endif
 
+// The possible destinations of the statistics reported at exit.
+enum class StatsOutput {
+  kNone,
+  kText,
+  kJson,
+};
+
 struct Configuration {
   // Indicates if the overall cmpcov instrumentation is enabled, as configured
   // through the standard ASAN_OPTIONS environment variable:
@@ -120,6 +230,37 @@ struct Configuration {
   // Default: true
   bool memory_cov_enabled;
 
+  // The number of consecutive executions of a comparison site which don't make
+  // any progress (i.e. can't produce new traces), after which the executions
+  // of the site are sampled with an exponential back-off, as configured by the
+  // TRACE_SAMPLING_THRESHOLD variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 TRACE_NONCONST_CMP=1 TRACE_SAMPLING_THRESHOLD=64
+  //
+  // The option reduces the overhead of very hot comparisons, e.g. in checksum
+  // loops or interpreter dispatch, at the cost of possibly noticing new traces
+  // at these sites with a delay.
+  //
+  // The value must be in the range of 0 to SiteThrottle::kMaxThreshold (239).
+  //
+  // Default: 0 (disabled)
+  size_t sampling_threshold;
+
+  // The maximum length of memory comparisons instrumented in the long
+  // comparison mode, as configured by the TRACE_LONG_CMP_LENGTH variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 TRACE_LONG_CMP_LENGTH=256
+  //
+  // Comparisons of up to kMaxDataCmpLength (32) bytes are always traced byte by
+  // byte. Longer ones, e.g. of magic headers, GUIDs or hashes, are dropped
+  // unless this mode is enabled, in which case their progress is only traced
+  // at milestones placed at every byte up to 32, and then four times per every
+  // doubling of the length, so that the number of traces stays logarithmic
+  // in the length. The value can't exceed kMaxLongDataCmpLength (4096).
+  //
+  // Default: 0 (disabled)
+  size_t long_cmp_length;
+
   // Stores the output directory path for the *.sancov files produced by the
   // instrumentation. It is configured through the coverage_dir switch in the
   // ASAN_OPTIONS environment variable:
@@ -128,14 +269,265 @@ struct Configuration {
   //
   // Default: "." (current directory)
   std::string coverage_dir;
+
+  // Indicates if traces are recorded in per-thread buffers rather than in a
+  // single global object guarded by a mutex, as configured by the
+  // CMPCOV_THREAD_LOCAL variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_THREAD_LOCAL=1
+  //
+  // The buffers are merged when the coverage is dumped to disk, so that the
+  // output is the same as in the default mode. The option is meant for heavily
+  // multi-threaded targets, where the global mutex becomes a bottleneck.
+  //
+  // Default: false
+  bool thread_local_traces;
+
+  // The number of unique traces that the trace deduplication tables are
+  // preallocated for, as configured by the CMPCOV_TABLE_CAPACITY variable. The
+  // tables grow when the capacity is exceeded, which causes a pause in the
+  // execution, so the value should be set above the expected number of traces
+  // in the process, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_TABLE_CAPACITY=1000000
+  //
+  // Default: 65536
+  size_t table_capacity;
+
+  // The limit of the memory (in MiB) used by every trace storage, i.e. by the
+  // global one, and by each of the per-thread buffers in the thread-local
+  // mode, as configured by the CMPCOV_MEMORY_LIMIT_MB variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_MEMORY_LIMIT_MB=64
+  //
+  // The limit is enforced by capping the number of unique traces, based on an
+  // upper bound of the memory used per trace (Traces::kMaxBytesPerTrace). Once
+  // it is reached, a message is printed on stderr, and new traces are dropped
+  // (and counted in the traces_over_limit statistic), while the traces found
+  // so far are still saved as usual.
+  //
+  // Default: 0 (unlimited)
+  size_t memory_limit_mb;
+
+  // Stores the identifier of a shared memory region to which traces are saved
+  // as they are found, instead of the .sancov files written at exit. The region
+  // is identified by a SysV shared memory ID on Linux, or the name of a file
+  // mapping object on Windows, as configured by the CMPCOV_SHM_ID variable,
+  // e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_SHM_ID=1234
+  //
+  // Default: "" (disabled)
+  std::string shared_memory_id;
+
+  // The interval in milliseconds at which a background thread appends the
+  // traces found since the previous flush to the .sancov files, as configured
+  // by the CMPCOV_FLUSH_INTERVAL_MS variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_FLUSH_INTERVAL_MS=5000
+  //
+  // The mode is meant for long-running processes which never exit cleanly, and
+  // thus never reach the regular dump at exit. The remaining traces are still
+  // flushed at exit, if it happens.
+  //
+  // Default: 0 (disabled)
+  size_t flush_interval_ms;
+
+  // Indicates if the traces are saved to memory-mapped .sancov files as soon as
+  // they are found, rather than written at exit, as configured by the
+  // CMPCOV_MAPPED_OUTPUT variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_MAPPED_OUTPUT=1
+  //
+  // The files are persisted even if the process crashes or is killed, which
+  // makes the option useful for collecting coverage of crashing and hanging
+  // inputs. In the thread-local mode, the traces reach the files when the
+  // per-thread buffers are merged, i.e. when the threads exit.
+  //
+  // Default: false
+  bool mapped_output;
+
+  // Indicates if the .sancov files written at exit use the compact format
+  // described in compact_format.h instead of the standard one, as configured
+  // by the CMPCOV_COMPACT_OUTPUT variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_COMPACT_OUTPUT=1
+  //
+  // The files written incrementally (with CMPCOV_FLUSH_INTERVAL_MS or
+  // CMPCOV_MAPPED_OUTPUT) always use the standard format, as they can't be
+  // sorted as a whole.
+  //
+  // Default: false
+  bool compact_output;
+
+  // Indicates if internal statistics are collected and reported at exit, as
+  // configured by the CMPCOV_STATS variable. With CMPCOV_STATS=1, they are
+  // printed on stderr next to the information about the output files, and with
+  // CMPCOV_STATS=json, they are saved to a cmpcov_stats.<pid>.json file in the
+  // coverage directory, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_STATS=json
+  //
+  // See stats.h for the list of counters.
+  //
+  // Default: StatsOutput::kNone
+  StatsOutput stats_output;
+
+  // Indicates if the process is used as a fork server, as configured by the
+  // CMPCOV_FORK_SERVER variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_FORK_SERVER=1 CMPCOV_SHM_ID=1234
+  //
+  // In this mode, the list of loaded modules is populated in the parent, so
+  // that the children inherit it together with the preallocated trace storage.
+  // Every forked child then starts with an empty trace state, and outputs of
+  // its own. The shared memory output is the recommended channel for the
+  // children, as it doesn't require creating files for every execution. The
+  // option is only supported on Linux.
+  //
+  // Default: false
+  bool fork_server;
+
+  // The number of the most frequently executed comparison sites saved at exit,
+  // as configured by the CMPCOV_PROFILE variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_PROFILE=100
+  //
+  // If set, the executions of all sites are counted, and the top sites are
+  // saved to a cmpcov_profile.<pid>.txt file in the coverage directory, one
+  // per line, as the module name, the offset of the site and its execution
+  // count. The file can be used directly as the denylist (see below).
+  //
+  // Default: 0 (disabled)
+  size_t profile_sites_count;
+
+  // The path of a file listing comparison sites which shouldn't be
+  // instrumented, as configured by the CMPCOV_DENYLIST variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_DENYLIST=/path/to/cmpcov_profile.1234.txt
+  //
+  // The callbacks of the listed sites return immediately. The sites are
+  // resolved in each module when one of its comparisons first runs, including
+  // the modules loaded after the initialization.
+  //
+  // Default: empty (disabled)
+  std::string denylist_path;
+
+  // Comma-separated lists of the names of modules in which the comparisons are
+  // traced, and in which they are ignored, as configured by the
+  // CMPCOV_INCLUDE_MODULES and CMPCOV_EXCLUDE_MODULES variables, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_INCLUDE_MODULES=fuzz_target,libparser.so
+  // ASAN_OPTIONS=coverage=1 CMPCOV_EXCLUDE_MODULES=libz.so.1,libssl.so.3
+  //
+  // The names are the file names of the executable images, as used in the
+  // names of the .sancov files. If the first list is non-empty, all modules
+  // not included in it are ignored. The callbacks of ignored modules return
+  // after a few address range checks. The lists are resolved in each module
+  // when one of its comparisons first runs, including the modules loaded after
+  // the initialization.
+  //
+  // Default: empty (all modules are traced)
+  std::string included_modules;
+  std::string excluded_modules;
+
+  // A comma-separated list of .sancov files (in the standard or compact
+  // format) with traces which are already known, e.g. found by the whole
+  // fuzzing corpus, as configured by the CMPCOV_BASELINE variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_BASELINE=/corpus/cmp.target.all.sancov
+  //
+  // The files are loaded at initialization, and their traces are never saved
+  // to any of the outputs, so that the output only contains the new traces.
+  // An execution which doesn't find any new traces doesn't create any files.
+  //
+  // Default: empty (disabled)
+  std::string baseline_files;
+
+  // The maximum number of tokens in the dictionary of comparison operands, as
+  // configured by the CMPCOV_DICTIONARY variable, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 TRACE_MEMORY_CMP=1 CMPCOV_DICTIONARY=4096
+  //
+  // If set, the constant operands of integer comparisons and switch cases, and
+  // both operands of memory comparisons (as it isn't known which one of them
+  // is constant), are recorded once per comparison site, unless the operands
+  // are equal. The tokens are saved to a cmpcov_dict.<pid>.txt file in the
+  // coverage directory at exit, in the dictionary format of AFL and libFuzzer,
+  // each preceded by a comment with the module name and offset of its site.
+  // Integer constants are saved in little-endian byte order.
+  //
+  // Default: 0 (disabled)
+  size_t dictionary_tokens_count;
+
+  // Stores the identifier of a shared memory region holding a table of the
+  // traces seen by all processes on the host, e.g. by parallel fuzzing workers,
+  // as configured by the CMPCOV_HOST_TABLE_ID variable. The region is
+  // identified the same way as in CMPCOV_SHM_ID, e.g.:
+  //
+  // ASAN_OPTIONS=coverage=1 CMPCOV_HOST_TABLE_ID=5678
+  //
+  // Traces found in the table are treated as already seen, and never saved to
+  // any of the outputs, so that every process only reports the traces which
+  // are new to the host. The table isn't affected by cmpcov_reset().
+  //
+  // Default: "" (disabled)
+  std::string host_table_id;
+};
+
+// The state of the incremental flushes of traces to disk, used when the
+// flush_interval_ms option is set.
+struct FlushState {
+  // A mutex serializing the flushes, guarding the members below.
+  std::mutex mutex;
+
+  // Names of the modules known at the time of the last flush, copied so that
+  // they can be accessed without holding cov_mutex.
+  ArenaVector<ArenaString> module_names;
+
+  // Indicates which modules have their .sancov files already created.
+  ArenaVector<bool> created_files;
+
+  // Set after the final flush at exit, after which no further flushes occur.
+  bool stopped;
 };
 
+// Bits of the globals::flags word, mirroring the corresponding options in the
+// configuration, so that they can be checked with a single memory load.
+const uint32_t kFlagInitialized = 1 << 0;
+const uint32_t kFlagEnabled = 1 << 1;
+const uint32_t kFlagNonconstCmp = 1 << 2;
+const uint32_t kFlagMemoryCmp = 1 << 3;
+const uint32_t kFlagSampling = 1 << 4;
+const uint32_t kFlagProfile = 1 << 5;
+const uint32_t kFlagDenylist = 1 << 6;
+const uint32_t kFlagModuleFilter = 1 << 7;
+const uint32_t kFlagDictionary = 1 << 8;
+
+// Build-time switches compiling out the support for some kinds of comparisons,
+// for deployments which never enable them. The callbacks of the disabled
+// comparisons return immediately, and the corresponding run-time options have
+// no effect.
+#ifdef CMPCOV_DISABLE_NONCONST
+const bool kNonconstCmpSupported = false;
+#else
+const bool kNonconstCmpSupported = true;
+#endif
+
+#ifdef CMPCOV_DISABLE_MEMCMP
+const bool kMemoryCmpSupported = false;
+#else
+const bool kMemoryCmpSupported = true;
+#endif
+
 namespace globals {
   // A global mutex guarding access to all of the variables and objects below.
   static std::mutex cov_mutex;
 
-  // Indicates if the cmpcov module has been initialized yet.
-  static bool initialized;
+  // A set of kFlag* bits describing the state of the module and the enabled
+  // instrumentation. The word is written once during initialization, and may
+  // be read without holding the mutex.
+  alignas(64) static std::atomic<uint32_t> flags;
 
   // A pointer to an object storing globally-accessible internal structures.
   // These structures are not destroyed before the death of the process.
@@ -144,8 +536,103 @@ namespace globals {
   // An internal class storing information about all execution traces registered
   // so far.
   static Traces *traces;
+
+  // A list of all per-thread trace buffers currently registered in the process,
+  // used in the thread-local mode.
+  static ArenaVector<ThreadTraces *> *thread_traces;
+
+  // A cache of the maximum number of matching bytes recorded at every
+  // comparison site. The object is internally synchronized, and may be accessed
+  // without holding the mutex.
+  static SaturationCache *saturation_cache;
+
+  // A cache of the preprocessed cases of switch statements. The object is
+  // internally synchronized, and may be accessed without holding the mutex.
+  static SwitchCache *switch_cache;
+
+  // The state of the incremental flushes, allocated only if they are enabled.
+  // The object is synchronized by its own mutex, which must never be acquired
+  // while holding cov_mutex.
+  static FlushState *flush_state;
+
+  // The memory-mapped output files, allocated only if they are enabled.
+  static MappedTraces *mapped_traces;
+
+  // The histogram of the executions of comparison sites, allocated only if the
+  // profiling is enabled. The object is internally synchronized, and may be
+  // accessed without holding the mutex.
+  static SiteProfile *site_profile;
+
+  // The sites which aren't instrumented, allocated only if a denylist is
+  // configured. The sites are resolved in new modules while holding the mutex,
+  // and the object may be looked up without holding it.
+  static SiteDenylist *site_denylist;
+
+  // The traces treated as already seen, allocated only if a baseline is
+  // configured. The object is immutable after initialization.
+  static BaselineTraces *baseline;
+
+  // The filter of the traced modules, allocated if it or the denylist is
+  // configured, as it also detects the modules which haven't been resolved yet.
+  // New modules are resolved while holding the mutex, and the object may be
+  // checked without holding it.
+  static ModuleFilter *module_filter;
+
+  // The number of modules registered in traces which have been resolved in the
+  // module filter and the denylist, guarded by the mutex.
+  static int resolved_modules_count;
+
+  // The dictionary of comparison operands, allocated only if it is enabled.
+  // The object is internally synchronized, and may be accessed without holding
+  // the mutex.
+  static OperandDictionary *operand_dictionary;
+
+  // The generation of the traces, incremented every time they are reset. It is
+  // used to invalidate the state of the sampling policy in all threads.
+  static std::atomic<uint32_t> traces_generation;
 }  // namespace globals
 
+static void RetireThreadTraces(ThreadTraces *thread_traces);
+
+// An owner of the per-thread trace buffer, which merges the buffer into the
+// global traces object when the thread exits.
+struct ThreadTracesOwner {
+  ~ThreadTracesOwner() {
+    if (thread_traces != nullptr) {
+      RetireThreadTraces(thread_traces);
+    }
+  }
+
+  ThreadTraces *thread_traces;
+};
+
+namespace tls {
+  // The trace buffer of the current thread, allocated on first use in the
+  // thread-local mode.
+  static thread_local ThreadTracesOwner owner;
+
+  // Indicates if the current thread is executing cmpcov code, used to detect
+  // reentry from the comparison hooks before any of the site policies are
+  // applied, and in the thread-local mode.
+  static thread_local bool in_cmpcov;
+
+  // The sampling policy of the current thread, allocated on first use if the
+  // sampling is enabled.
+  static thread_local std::unique_ptr<SiteThrottle, ArenaDeleter<SiteThrottle>>
+      site_throttle;
+}  // namespace tls
+
+// A scoped object marking the current thread as executing cmpcov code, so that
+// the comparisons made by cmpcov itself in the meantime are not instrumented.
+class ReentryGuard {
+ public:
+  ReentryGuard() : previous_(tls::in_cmpcov) { tls::in_cmpcov = true; }
+  ~ReentryGuard() { tls::in_cmpcov = previous_; }
+
+ private:
+  const bool previous_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Helper functions.
@@ -181,289 +668,1493 @@ static void ParseAsanConfig() {
   if (memory_cmp_ptr != nullptr) {
     globals::config->memory_cov_enabled = (atoi(memory_cmp_ptr) == 0);
   }
-}
 
-static void DumpCoverageOnExit() {
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  const char *sampling_threshold_ptr = getenv("TRACE_SAMPLING_THRESHOLD");
+  if (sampling_threshold_ptr != nullptr) {
+    globals::config->sampling_threshold =
+        strtoul(sampling_threshold_ptr, nullptr, 10);
+    if (globals::config->sampling_threshold > SiteThrottle::kMaxThreshold) {
+      Die("The TRACE_SAMPLING_THRESHOLD value must not exceed %u.\n",
+          SiteThrottle::kMaxThreshold);
+    }
+  }
 
-  struct OutputFileDescriptor {
-    FILE *file;
-    int counter;
-    char path[MAX_PATH];
-  };
-  std::vector<OutputFileDescriptor> output_files(
-      globals::traces->GetModulesCount());
-
-  std::vector<std::pair<int, size_t>> traces_list;
-  globals::traces->GetTracesList(&traces_list);
-
-  for (const auto& trace : traces_list) {
-    const int mod_idx = trace.first;
-    auto& output_file = output_files[mod_idx];
-    FILE *f = output_file.file;
-
-    if (f == nullptr) {
-      snprintf(output_file.path, sizeof(output_file.path),
-               "%s/cmp.%s.%d.sancov",
-               globals::config->coverage_dir.c_str(),
-               globals::traces->GetModuleName(mod_idx).c_str(),
-               GetPid());
-
-      f = fopen(output_file.path, "w+b");
-      if (f == nullptr) {
-        Die("Unable to open the \"%s\" file for writing.\n", output_file.path);
-      }
+  const char *long_cmp_length_ptr = getenv("TRACE_LONG_CMP_LENGTH");
+  if (long_cmp_length_ptr != nullptr) {
+    globals::config->long_cmp_length =
+        strtoul(long_cmp_length_ptr, nullptr, 10);
+    if (globals::config->long_cmp_length > kMaxLongDataCmpLength) {
+      Die("The TRACE_LONG_CMP_LENGTH value must not exceed %zu.\n",
+          kMaxLongDataCmpLength);
+    }
+  }
 
-      fwrite(&kMagic, sizeof(kMagic), 1, f);
+  const char *thread_local_ptr = getenv("CMPCOV_THREAD_LOCAL");
+  if (thread_local_ptr != nullptr) {
+    globals::config->thread_local_traces = (atoi(thread_local_ptr) != 0);
+  }
 
-      output_file.file = f;
-    }
+  const char *table_capacity_ptr = getenv("CMPCOV_TABLE_CAPACITY");
+  if (table_capacity_ptr != nullptr) {
+    globals::config->table_capacity = strtoul(table_capacity_ptr, nullptr, 10);
+  }
 
-    fwrite(&trace.second, sizeof(size_t), 1, f);
+  const char *memory_limit_ptr = getenv("CMPCOV_MEMORY_LIMIT_MB");
+  if (memory_limit_ptr != nullptr) {
+    globals::config->memory_limit_mb = strtoul(memory_limit_ptr, nullptr, 10);
+  }
 
-    output_file.counter++;
+  const char *shm_id_ptr = getenv("CMPCOV_SHM_ID");
+  if (shm_id_ptr != nullptr) {
+    globals::config->shared_memory_id = shm_id_ptr;
   }
 
-  for (const auto& output_file : output_files) {
-    if (output_file.file != nullptr) {
-      fprintf(stderr, "CmpSanitizerCoverage: %s: %d PCs written\n",
-              output_file.path, output_file.counter);
+  const char *flush_interval_ptr = getenv("CMPCOV_FLUSH_INTERVAL_MS");
+  if (flush_interval_ptr != nullptr) {
+    globals::config->flush_interval_ms =
+        strtoul(flush_interval_ptr, nullptr, 10);
+  }
 
-      fclose(output_file.file);
-    }
+  const char *mapped_output_ptr = getenv("CMPCOV_MAPPED_OUTPUT");
+  if (mapped_output_ptr != nullptr) {
+    globals::config->mapped_output = (atoi(mapped_output_ptr) != 0);
   }
-}
 
-static void Initialize() {
-  // Bail out if already initialized.
-  if (globals::initialized) {
-    return;
+  const char *compact_output_ptr = getenv("CMPCOV_COMPACT_OUTPUT");
+  if (compact_output_ptr != nullptr) {
+    globals::config->compact_output = (atoi(compact_output_ptr) != 0);
   }
 
-  // Allocate the configuration and traces objects.
-  globals::config = new Configuration;
-  globals::traces = new Traces;
+  const char *fork_server_ptr = getenv("CMPCOV_FORK_SERVER");
+  if (fork_server_ptr != nullptr) {
+    globals::config->fork_server = (atoi(fork_server_ptr) != 0);
+  }
 
-  // Set up some sane defaults.
-  globals::config->enabled = false;
-  globals::config->nonconst_cov_enabled = false;
-  globals::config->memory_cov_enabled = true;
-  globals::config->coverage_dir = ".";
+  const char *profile_ptr = getenv("CMPCOV_PROFILE");
+  if (profile_ptr != nullptr) {
+    globals::config->profile_sites_count = strtoul(profile_ptr, nullptr, 10);
+  }
 
-  // Initialize the configuration data based on the ASAN_OPTIONS variable.
-  ParseAsanConfig();
+  const char *denylist_ptr = getenv("CMPCOV_DENYLIST");
+  if (denylist_ptr != nullptr) {
+    globals::config->denylist_path = denylist_ptr;
+  }
 
-  // Register a destructor to save output data if the instrumentation is
-  // enabled.
-  if (globals::config->enabled) {
-    atexit(DumpCoverageOnExit);
+  const char *included_modules_ptr = getenv("CMPCOV_INCLUDE_MODULES");
+  if (included_modules_ptr != nullptr) {
+    globals::config->included_modules = included_modules_ptr;
   }
 
-  globals::initialized = true;
-}
+  const char *excluded_modules_ptr = getenv("CMPCOV_EXCLUDE_MODULES");
+  if (excluded_modules_ptr != nullptr) {
+    globals::config->excluded_modules = excluded_modules_ptr;
+  }
 
-static size_t InternalStrnlen(const char *s, size_t max_length) {
-  size_t len = 0;
-  for (; len < max_length && s[len] != '\0'; len++) { }
-  return len;
-}
+  const char *baseline_ptr = getenv("CMPCOV_BASELINE");
+  if (baseline_ptr != nullptr) {
+    globals::config->baseline_files = baseline_ptr;
+  }
 
-static size_t InternalStrnlen2(
-    const char *s1, const char *s2, size_t max_length) {
-  size_t len = 0;
-  for (; len < max_length && s1[len] != '\0' && s2[len] != '\0'; len++) { }
-  return len;
-}
+  const char *dictionary_ptr = getenv("CMPCOV_DICTIONARY");
+  if (dictionary_ptr != nullptr) {
+    globals::config->dictionary_tokens_count =
+        strtoul(dictionary_ptr, nullptr, 10);
+  }
 
-static int GetUint32Width(uint32_t x) {
-  return (32 - (__builtin_clz(x) & (~7))) / 8;
-}
+  const char *host_table_id_ptr = getenv("CMPCOV_HOST_TABLE_ID");
+  if (host_table_id_ptr != nullptr) {
+    globals::config->host_table_id = host_table_id_ptr;
+  }
 
-static int GetUint64Width(uint64_t x) {
-  return (64 - (__builtin_clzll(x) & (~7))) / 8;
+  const char *stats_ptr = getenv("CMPCOV_STATS");
+  if (stats_ptr != nullptr) {
+    if (!strcmp(stats_ptr, "json")) {
+      globals::config->stats_output = StatsOutput::kJson;
+    } else if (atoi(stats_ptr) != 0) {
+      globals::config->stats_output = StatsOutput::kText;
+    }
+  }
 }
 
-static int CountMatchingBytes(int count, uint64_t x, uint64_t y) {
-  int i;
-  for (i = 0; i < count; i++) {
-    if (((x >> (i * 8)) & 0xff) != ((y >> (i * 8)) & 0xff)) {
-      break;
-    }
+// Merges the traces from all per-thread buffers into the global object. Must be
+// called with cov_mutex held.
+static void MergeThreadTraces() {
+  tls::in_cmpcov = true;
+  for (ThreadTraces *thread_traces : *globals::thread_traces) {
+    std::lock_guard<std::mutex> lock(thread_traces->mutex());
+    thread_traces->MergeInto(globals::traces);
   }
-  return i;
+  tls::in_cmpcov = false;
 }
 
-static void CommonHandleCmpTrace(uint64_t arg1, uint64_t arg2, int arg_length,
-                                 int switch_case, void *pc) {
-  const int matching_bytes = CountMatchingBytes(arg_length, arg1, arg2);
-  for (int i = 1; i <= matching_bytes; i++) {
-    globals::traces->TrySaveTrace(reinterpret_cast<size_t>(pc),
-                                  /*trace_arg1=*/arg_length - i, /*trace_arg2=*/switch_case);
+// Resets all per-thread trace buffers. Must be called with cov_mutex held.
+static void ResetThreadTraces() {
+  for (ThreadTraces *thread_traces : *globals::thread_traces) {
+    std::lock_guard<std::mutex> lock(thread_traces->mutex());
+    thread_traces->Reset();
   }
 }
 
-static void CommonHandleMemcmpTrace(const char *s1, const char *s2, int length,
-                                    void *pc) {
-  int matching_bytes;
-  for (matching_bytes = 0; matching_bytes < length; matching_bytes++) {
-    if (*s1++ != *s2++) {
-      break;
-    }
+// Returns the maximum number of unique traces in any single trace storage,
+// which follows from the memory limit.
+static size_t GetMaxTraces() {
+  if (globals::config->memory_limit_mb == 0) {
+    return SIZE_MAX;
   }
+  return globals::config->memory_limit_mb * 1024 * 1024 /
+         Traces::kMaxBytesPerTrace;
+}
 
-  for (int i = 1; i <= matching_bytes; i++) {
-    globals::traces->TrySaveTrace(reinterpret_cast<size_t>(pc),
-                                  /*trace_arg1=*/kMemcmpTraceArg1,
-                                  /*trace_arg2=*/length - i);
+static ThreadTraces *GetThreadTraces() {
+  if (tls::owner.thread_traces == nullptr) {
+    std::lock_guard<std::mutex> lock(globals::cov_mutex);
+    tls::owner.thread_traces =
+        ArenaNew<ThreadTraces>(globals::config->table_capacity,
+                               GetMaxTraces());
+    globals::thread_traces->push_back(tls::owner.thread_traces);
   }
+  return tls::owner.thread_traces;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-//
-// Declarations of SanitizerCoverage callback functions invoked before every
-// executed comparison in the program.
-//
-////////////////////////////////////////////////////////////////////////////////
+static void RetireThreadTraces(ThreadTraces *thread_traces) {
+  tls::in_cmpcov = true;
 
-extern "C" {
+  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  {
+    std::lock_guard<std::mutex> buffer_lock(thread_traces->mutex());
+    thread_traces->MergeInto(globals::traces);
+  }
 
-void __sanitizer_cov_trace_cmp1(uint8_t Arg1, uint8_t Arg2) {
-  // Single-byte comparisons are not instrumented. It is assumed that fuzzers
-  // typically operate on byte granularity and are able to eventually guess the
-  // value of a byte in the input stream. Performing cmp instrumentation on a
-  // bit-level could unnecessarily bloat the size of the coverage information
-  // log.
+  auto& list = *globals::thread_traces;
+  list.erase(std::remove(list.begin(), list.end(), thread_traces), list.end());
+  ArenaDelete(thread_traces);
 }
 
-void __sanitizer_cov_trace_cmp2(uint16_t Arg1, uint16_t Arg2) {
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+// Writes the (module index, trace) pairs to the per-module .sancov files in the
+// coverage directory, with a single write per file. If |created_files| is
+// specified, the traces are appended to the files already marked as created in
+// it, and the newly created files are marked; otherwise, all files are written
+// from scratch.
+static void WriteCoverageFiles(
+    const ArenaVector<uint64_t>& traces,
+    const ArenaVector<ArenaString>& module_names,
+    ArenaVector<bool> *created_files, bool verbose) {
+  // Group the traces by module: first count them, then lay out the contents of
+  // all output files in a single buffer, each consisting of the magic value (in
+  // new files) followed by the traces of the module in the order they were
+  // found.
+  const int modules_count = module_names.size();
+
+  ArenaVector<size_t> module_traces(modules_count);
+  for (uint64_t packed_trace : traces) {
+    module_traces[Traces::UnpackTrace(packed_trace).first]++;
+  }
 
-  if (!globals::initialized) {
-    Initialize();
+  ArenaVector<bool> needs_magic(modules_count);
+  ArenaVector<size_t> file_offsets(modules_count + 1);
+  for (int i = 0; i < modules_count; i++) {
+    size_t file_size = 0;
+    if (module_traces[i] != 0) {
+      needs_magic[i] = (created_files == nullptr || !(*created_files)[i]);
+      file_size = (needs_magic[i] ? sizeof(kMagic) : 0) +
+                  module_traces[i] * sizeof(size_t);
+    }
+    file_offsets[i + 1] = file_offsets[i] + file_size;
   }
-  if (!globals::config->enabled || !globals::config->nonconst_cov_enabled) {
-    return;
+
+  ArenaVector<uint8_t> buffer(file_offsets[modules_count]);
+  ArenaVector<size_t> write_offsets(file_offsets.begin(),
+                                    file_offsets.end() - 1);
+  for (int i = 0; i < modules_count; i++) {
+    if (needs_magic[i]) {
+      memcpy(&buffer[write_offsets[i]], &kMagic, sizeof(kMagic));
+      write_offsets[i] += sizeof(kMagic);
+    }
   }
 
-  CommonHandleCmpTrace(Arg1, Arg2, /*arg_length=*/2, /*switch_case=*/0,
-                       __builtin_return_address(0));
-}
+  for (uint64_t packed_trace : traces) {
+    const auto trace = Traces::UnpackTrace(packed_trace);
+    memcpy(&buffer[write_offsets[trace.first]], &trace.second, sizeof(size_t));
+    write_offsets[trace.first] += sizeof(size_t);
+  }
 
-void __sanitizer_cov_trace_cmp4(uint32_t Arg1, uint32_t Arg2) {
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  // Write each file with a single call.
+  for (int i = 0; i < modules_count; i++) {
+    if (module_traces[i] == 0) {
+      continue;
+    }
+
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/cmp.%s.%d.sancov",
+             globals::config->coverage_dir.c_str(),
+             module_names[i].c_str(),
+             GetPid());
+
+    WriteFileOrDie(path, &buffer[file_offsets[i]],
+                   file_offsets[i + 1] - file_offsets[i],
+                   /*append=*/!needs_magic[i]);
+    if (created_files != nullptr) {
+      (*created_files)[i] = true;
+    }
 
-  if (!globals::initialized) {
-    Initialize();
+    if (verbose) {
+      fprintf(stderr, "CmpSanitizerCoverage: %s: %zu PCs written\n",
+              path, module_traces[i]);
+    }
   }
-  if (!globals::config->enabled || !globals::config->nonconst_cov_enabled) {
-    return;
+}
+
+// Writes the (module index, trace) pairs to the per-module .sancov files in the
+// coverage directory, in the compact format.
+static void WriteCompactCoverageFiles(
+    const ArenaVector<uint64_t>& traces,
+    const ArenaVector<ArenaString>& module_names) {
+  ArenaVector<ArenaVector<size_t>> module_traces(module_names.size());
+  for (uint64_t packed_trace : traces) {
+    const auto trace = Traces::UnpackTrace(packed_trace);
+    module_traces[trace.first].push_back(trace.second);
   }
 
-  CommonHandleCmpTrace(Arg1, Arg2, /*arg_length=*/4, /*switch_case=*/0,
-                       __builtin_return_address(0));
-}
+  ArenaVector<uint8_t> buffer;
+  for (int i = 0; i < module_names.size(); i++) {
+    if (module_traces[i].empty()) {
+      continue;
+    }
 
-void __sanitizer_cov_trace_cmp8(uint64_t Arg1, uint64_t Arg2) {
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/cmp.%s.%d.sancov",
+             globals::config->coverage_dir.c_str(),
+             module_names[i].c_str(),
+             GetPid());
+
+    buffer.clear();
+    EncodeCompactTraces(&module_traces[i], &buffer);
+    WriteFileOrDie(path, buffer.data(), buffer.size(), /*append=*/false);
 
-  if (!globals::initialized) {
-    Initialize();
+    fprintf(stderr, "CmpSanitizerCoverage: %s: %zu PCs written\n",
+            path, module_traces[i].size());
   }
-  if (!globals::config->enabled || !globals::config->nonconst_cov_enabled) {
-    return;
+}
+
+// Appends the traces found since the previous flush to the .sancov files. The
+// cov_mutex is only held while the queue of new traces is swapped out (and the
+// per-thread buffers are merged in the thread-local mode), so the callbacks are
+// not blocked for the time of the I/O. Returns false if the flushes have been
+// stopped.
+static bool FlushNewTraces(bool final_flush) {
+  FlushState *state = globals::flush_state;
+  std::lock_guard<std::mutex> flush_lock(state->mutex);
+  if (state->stopped) {
+    return false;
   }
+  state->stopped = final_flush;
 
-  CommonHandleCmpTrace(Arg1, Arg2, /*arg_length=*/8, /*switch_case=*/0,
-                       __builtin_return_address(0));
-}
+  ArenaVector<uint64_t> traces;
+  {
+    std::lock_guard<std::mutex> lock(globals::cov_mutex);
+    if (globals::config->thread_local_traces) {
+      MergeThreadTraces();
+    }
 
-void __sanitizer_cov_trace_const_cmp1(uint8_t Arg1, uint8_t Arg2) {
-  // Single-byte comparisons are not instrumented. It is assumed that fuzzers
-  // typically operate on byte granularity and are able to eventually guess the
-  // value of a byte in the input stream. Performing cmp instrumentation on a
-  // bit-level could unnecessarily bloat the size of the coverage information
-  // log.
-}
+    globals::traces->SwapFlushQueue(&traces);
 
-void __sanitizer_cov_trace_const_cmp2(uint16_t Arg1, uint16_t Arg2) {
-  // Quick initial check if the constant value is wider than a single byte. If
-  // not, we skip the instrumentation of the comparison.
-  if (Arg1 < 0x100) {
-    return;
+    const int modules_count = globals::traces->GetModulesCount();
+    for (int i = state->module_names.size(); i < modules_count; i++) {
+      state->module_names.push_back(globals::traces->GetModuleName(i));
+    }
   }
 
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  state->created_files.resize(state->module_names.size());
+  WriteCoverageFiles(traces, state->module_names, &state->created_files,
+                     /*verbose=*/final_flush);
+  return true;
+}
 
-  if (!globals::initialized) {
-    Initialize();
-  }
-  if (!globals::config->enabled) {
-    return;
-  }
+// The routine of the background thread performing the periodic flushes.
+static void FlushThreadRoutine() {
+  // The thread only ever executes cmpcov code.
+  tls::in_cmpcov = true;
 
-  CommonHandleCmpTrace(Arg1, Arg2, /*arg_length=*/2, /*switch_case=*/0,
-                       __builtin_return_address(0));
+  const auto interval =
+      std::chrono::milliseconds(globals::config->flush_interval_ms);
+  do {
+    std::this_thread::sleep_for(interval);
+  } while (FlushNewTraces(/*final_flush=*/false));
 }
 
-void __sanitizer_cov_trace_const_cmp4(uint32_t Arg1, uint32_t Arg2) {
-  // Quick initial check if the constant value is wider than a single byte. If
-  // not, we skip the instrumentation of the comparison.
-  if (Arg1 < 0x100) {
+static void DumpCoverageOnExit() {
+  tls::in_cmpcov = true;
+
+  // In the incremental mode, only the traces found since the last flush remain
+  // to be saved.
+  if (globals::flush_state != nullptr) {
+    FlushNewTraces(/*final_flush=*/true);
     return;
   }
 
   std::lock_guard<std::mutex> lock(globals::cov_mutex);
 
-  if (!globals::initialized) {
-    Initialize();
+  if (globals::config->thread_local_traces) {
+    MergeThreadTraces();
   }
-  if (!globals::config->enabled) {
+
+  // With a shared memory output, the traces have already been saved (or have
+  // just been saved by the merge above), so there is nothing left to do.
+  if (!globals::config->shared_memory_id.empty()) {
     return;
   }
 
-  CommonHandleCmpTrace(Arg1, Arg2,
-                       /*arg_length=*/GetUint32Width(Arg1), /*switch_case=*/0,
-                       __builtin_return_address(0));
-}
-
-void __sanitizer_cov_trace_const_cmp8(uint64_t Arg1, uint64_t Arg2) {
-  // Quick initial check if the constant value is wider than a single byte. If
-  // not, we skip the instrumentation of the comparison.
-  if (Arg1 < 0x100) {
+  // The same goes for memory-mapped output files, which only need to be
+  // truncated to the size of their contents.
+  if (globals::mapped_traces != nullptr) {
+    globals::mapped_traces->Finalize();
     return;
   }
 
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  ArenaVector<ArenaString> module_names;
+  for (int i = 0; i < globals::traces->GetModulesCount(); i++) {
+    module_names.push_back(globals::traces->GetModuleName(i));
+  }
 
-  if (!globals::initialized) {
-    Initialize();
+  if (globals::config->compact_output) {
+    WriteCompactCoverageFiles(globals::traces->GetTracesList(), module_names);
+  } else {
+    WriteCoverageFiles(globals::traces->GetTracesList(), module_names,
+                       /*created_files=*/nullptr, /*verbose=*/true);
   }
-  if (!globals::config->enabled) {
+}
+
+static void ReportStatsOnExit() {
+  uint64_t stats[kStatsCount];
+  GetStats(stats);
+
+  if (globals::config->stats_output == StatsOutput::kText) {
+    for (int i = 0; i < kStatsCount; i++) {
+      fprintf(stderr, "CmpSanitizerCoverage: stats: %s: %" PRIu64 "\n",
+              GetStatName(static_cast<Stat>(i)), stats[i]);
+    }
     return;
   }
 
-  CommonHandleCmpTrace(Arg1, Arg2,
-                       /*arg_length=*/GetUint64Width(Arg1), /*switch_case=*/0,
-                       __builtin_return_address(0));
+  std::string json = "{";
+  for (int i = 0; i < kStatsCount; i++) {
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%s\"%s\": %" PRIu64, (i == 0) ? "" : ", ",
+             GetStatName(static_cast<Stat>(i)), stats[i]);
+    json += entry;
+  }
+  json += "}\n";
+
+  char path[MAX_PATH];
+  snprintf(path, sizeof(path), "%s/cmpcov_stats.%d.json",
+           globals::config->coverage_dir.c_str(), GetPid());
+  WriteFileOrDie(path, json.data(), json.size(), /*append=*/false);
+
+  fprintf(stderr, "CmpSanitizerCoverage: %s: statistics written\n", path);
 }
 
-void __sanitizer_cov_trace_switch(uint64_t Val, uint64_t *Cases) {
-  // If there are no cases in the switch() construct (possibly because we
-  // overwrote it earlier to prevent this switch from being processed again),
-  // return immediately.
-  if (Cases[0] == 0) {
-    return;
+// Saves the most frequently executed comparison sites to a text file in the
+// coverage directory, one per line.
+static void ReportProfileOnExit() {
+  const auto sites = globals::site_profile->GetTopSites(
+      globals::config->profile_sites_count);
+
+  std::string text;
+  {
+    std::lock_guard<std::mutex> lock(globals::cov_mutex);
+    tls::in_cmpcov = true;
+
+    char line[MAX_PATH + 64];
+    snprintf(line, sizeof(line),
+             "# Executions of sites not included in the profile: %" PRIu64
+             "\n", globals::site_profile->GetDroppedCount());
+    text += line;
+
+    for (const auto& site : sites) {
+      int module_index;
+      size_t offset;
+      if (!globals::traces->TranslateAddress(site.first, &module_index,
+                                             &offset)) {
+        continue;
+      }
+
+      snprintf(line, sizeof(line), "%s 0x%zx %" PRIu64 "\n",
+               globals::traces->GetModuleName(module_index).c_str(), offset,
+               site.second);
+      text += line;
+    }
+    tls::in_cmpcov = false;
   }
 
-  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  char path[MAX_PATH];
+  snprintf(path, sizeof(path), "%s/cmpcov_profile.%d.txt",
+           globals::config->coverage_dir.c_str(), GetPid());
+  WriteFileOrDie(path, text.data(), text.size(), /*append=*/false);
 
-  if (!globals::initialized) {
-    Initialize();
+  fprintf(stderr, "CmpSanitizerCoverage: %s: %zu sites written\n", path,
+          sites.size());
+}
+
+// Appends a token to a dictionary in the AFL/libFuzzer format, as a quoted
+// string with all non-printable characters escaped.
+static void AppendDictionaryToken(const std::string& token, std::string *text) {
+  *text += '"';
+  for (unsigned char c : token) {
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+      *text += static_cast<char>(c);
+    } else {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+      *text += escaped;
+    }
+  }
+  *text += "\"\n";
+}
+
+// Saves the dictionary of comparison operands to a text file in the coverage
+// directory.
+static void ReportDictionaryOnExit() {
+  const auto tokens = globals::operand_dictionary->GetTokens();
+
+  std::string text;
+  size_t tokens_count = 0;
+  {
+    std::lock_guard<std::mutex> lock(globals::cov_mutex);
+    tls::in_cmpcov = true;
+
+    char line[MAX_PATH + 64];
+    snprintf(line, sizeof(line),
+             "# Tokens not included in the dictionary: %" PRIu64 "\n",
+             globals::operand_dictionary->GetDroppedCount());
+    text += line;
+
+    for (const auto& token : tokens) {
+      int module_index;
+      size_t offset;
+      if (!globals::traces->TranslateAddress(token.first, &module_index,
+                                             &offset)) {
+        continue;
+      }
+
+      snprintf(line, sizeof(line), "# %s 0x%zx\n",
+               globals::traces->GetModuleName(module_index).c_str(), offset);
+      text += line;
+      AppendDictionaryToken(token.second, &text);
+      tokens_count++;
+    }
+    tls::in_cmpcov = false;
+  }
+
+  char path[MAX_PATH];
+  snprintf(path, sizeof(path), "%s/cmpcov_dict.%d.txt",
+           globals::config->coverage_dir.c_str(), GetPid());
+  WriteFileOrDie(path, text.data(), text.size(), /*append=*/false);
+
+  fprintf(stderr, "CmpSanitizerCoverage: %s: %zu tokens written\n", path,
+          tokens_count);
+}
+
+#ifdef __linux__
+// Acquires all locks of the module before a fork, so that none of them is
+// inherited by the child in a locked state, and captures any modules loaded
+// since the last fork in the parent.
+static void PrepareFork() {
+  if (globals::flush_state != nullptr) {
+    globals::flush_state->mutex.lock();
+  }
+  globals::cov_mutex.lock();
+  for (ThreadTraces *thread_traces : *globals::thread_traces) {
+    thread_traces->mutex().lock();
+  }
+
+  globals::traces->PreloadModules();
+
+  // The arena is locked last, as the preload above may allocate from it.
+  LockArena();
+}
+
+// Releases the locks acquired by PrepareFork, except for the arena lock.
+static void ReleaseForkLocks() {
+  for (ThreadTraces *thread_traces : *globals::thread_traces) {
+    thread_traces->mutex().unlock();
+  }
+  globals::cov_mutex.unlock();
+  if (globals::flush_state != nullptr) {
+    globals::flush_state->mutex.unlock();
+  }
+}
+
+static void ResumeParentAfterFork() {
+  UnlockArena();
+  ReleaseForkLocks();
+}
+
+// Discards the trace state inherited by a forked child, so that it only reports
+// the traces of its own execution. The tables are cleared in time proportional
+// to the number of traces found by the parent, which is normally close to zero
+// in a fork server, and the caches are invalidated by advancing generations.
+static void ResetChildAfterFork() {
+  // The child is single-threaded, and the reset below needs the arena.
+  UnlockArena();
+
+  for (ThreadTraces *thread_traces : *globals::thread_traces) {
+    thread_traces->Reset();
+  }
+  globals::traces->Reset();
+  globals::saturation_cache->Reset();
+  globals::traces_generation.fetch_add(1, std::memory_order_relaxed);
+
+  // The traces queued for a flush belong to the parent, as do the .sancov files
+  // created so far. The child writes its own files, named after its PID, so
+  // all of its traces are saved to them anew.
+  globals::traces->ForgetSavedTraces();
+  ArenaVector<uint64_t> parent_flush_queue;
+  globals::traces->SwapFlushQueue(&parent_flush_queue);
+  if (globals::flush_state != nullptr) {
+    globals::flush_state->created_files.clear();
   }
-  if (!globals::config->enabled) {
+
+  if (globals::mapped_traces != nullptr) {
+    globals::mapped_traces->Detach();
+    delete globals::mapped_traces;
+
+    globals::mapped_traces = new MappedTraces(globals::config->coverage_dir);
+    globals::traces->SetMappedTraces(globals::mapped_traces);
+  }
+
+  ReleaseForkLocks();
+
+  // Threads don't survive a fork, so the flushing thread has to be restarted.
+  if (globals::flush_state != nullptr && !globals::flush_state->stopped) {
+    std::thread(FlushThreadRoutine).detach();
+  }
+}
+#endif  // __linux__
+
+// Resolves the module filter and the denylist in the modules registered since
+// the previous call. Must be called with cov_mutex held.
+static void ResolveNewModules() {
+  const int modules_count = globals::traces->GetModulesCount();
+  for (int i = globals::resolved_modules_count; i < modules_count; i++) {
+    const char *name = globals::traces->GetModuleName(i).c_str();
+    const size_t base = globals::traces->GetModuleBaseAddress(i);
+
+    // The denylist is resolved first, so that its sites are in place by the
+    // time the filter makes the module known to other threads.
+    if (globals::site_denylist != nullptr) {
+      globals::site_denylist->Resolve(name, base);
+    }
+    globals::module_filter->Resolve(name, base,
+                                    globals::traces->GetModuleSize(i));
+  }
+  globals::resolved_modules_count = modules_count;
+}
+
+static void Initialize() {
+  // Bail out if already initialized.
+  if (globals::flags.load(std::memory_order_relaxed) & kFlagInitialized) {
     return;
   }
 
+  // Allocate the configuration object.
+  globals::config = new Configuration;
+
+  // Set up some sane defaults.
+  globals::config->enabled = false;
+  globals::config->nonconst_cov_enabled = false;
+  globals::config->memory_cov_enabled = true;
+  globals::config->sampling_threshold = 0;
+  globals::config->long_cmp_length = 0;
+  globals::config->coverage_dir = ".";
+  globals::config->thread_local_traces = false;
+  globals::config->table_capacity = 65536;
+  globals::config->memory_limit_mb = 0;
+  globals::config->flush_interval_ms = 0;
+  globals::config->mapped_output = false;
+  globals::config->compact_output = false;
+  globals::config->stats_output = StatsOutput::kNone;
+  globals::config->fork_server = false;
+  globals::config->profile_sites_count = 0;
+  globals::config->dictionary_tokens_count = 0;
+
+  // Initialize the configuration data based on the ASAN_OPTIONS variable.
+  ParseAsanConfig();
+
+  // Allocate the traces objects, which depend on the configuration.
+  globals::traces =
+      new Traces(globals::config->table_capacity, GetMaxTraces());
+  globals::thread_traces = ArenaNew<ArenaVector<ThreadTraces *>>();
+  globals::saturation_cache = new SaturationCache;
+  globals::switch_cache = new SwitchCache;
+
+  // Load the baseline traces, if there are any.
+  if (globals::config->enabled && !globals::config->baseline_files.empty()) {
+    globals::baseline = new BaselineTraces;
+    for (const std::string& path :
+         SplitList(globals::config->baseline_files)) {
+      globals::baseline->Load(path.c_str());
+    }
+    globals::traces->SetBaseline(globals::baseline);
+  }
+
+  // Attach to the host-wide table of seen traces, if there is one. Similarly to
+  // the shared memory output, the region is never detached.
+  if (globals::config->enabled && !globals::config->host_table_id.empty()) {
+    globals::traces->SetHostTable(
+        new HostTraceTable(globals::config->host_table_id.c_str()));
+  }
+
+  // Attach to the shared memory output, if there is one. The region is never
+  // detached, as traces may be saved until the very end of the process.
+  if (globals::config->enabled && !globals::config->shared_memory_id.empty()) {
+    globals::traces->SetSharedTraces(
+        new SharedTraces(globals::config->shared_memory_id.c_str()));
+  }
+
+  // Otherwise, set up the memory-mapped output files, if requested.
+  if (globals::config->enabled && globals::config->mapped_output &&
+      globals::config->shared_memory_id.empty()) {
+    globals::mapped_traces = new MappedTraces(globals::config->coverage_dir);
+    globals::traces->SetMappedTraces(globals::mapped_traces);
+  }
+
+  // Start the periodic flushes of new traces to disk, if requested. They are
+  // not needed with outputs which receive the traces immediately.
+  if (globals::config->enabled && globals::config->flush_interval_ms != 0 &&
+      globals::config->shared_memory_id.empty() &&
+      globals::mapped_traces == nullptr) {
+    globals::flush_state = new FlushState;
+    globals::flush_state->stopped = false;
+    globals::traces->EnableFlushQueue();
+    std::thread(FlushThreadRoutine).detach();
+  }
+
+#ifdef __linux__
+  // Prepare for the forks of a fork server, if requested.
+  if (globals::config->enabled && globals::config->fork_server) {
+    globals::traces->PreloadModules();
+    pthread_atfork(PrepareFork, ResumeParentAfterFork, ResetChildAfterFork);
+  }
+#endif
+
+  // Load the denylist and the module filter, and resolve them in the modules
+  // loaded so far. The modules loaded later are resolved on first use, see
+  // IsModuleAccepted.
+  if (globals::config->enabled && !globals::config->denylist_path.empty()) {
+    globals::site_denylist = new SiteDenylist;
+    globals::site_denylist->Load(globals::config->denylist_path.c_str());
+  }
+
+  if (globals::config->enabled &&
+      (globals::site_denylist != nullptr ||
+       !globals::config->included_modules.empty() ||
+       !globals::config->excluded_modules.empty())) {
+    globals::module_filter = new ModuleFilter(
+        globals::config->included_modules, globals::config->excluded_modules);
+    globals::traces->PreloadModules();
+    ResolveNewModules();
+  }
+
+  // Start profiling the comparison sites, if requested.
+  if (globals::config->enabled && globals::config->profile_sites_count != 0) {
+    globals::site_profile = new SiteProfile;
+    atexit(ReportProfileOnExit);
+  }
+
+  // Start recording the dictionary of comparison operands, if requested.
+  if (globals::config->enabled &&
+      globals::config->dictionary_tokens_count != 0) {
+    globals::operand_dictionary =
+        new OperandDictionary(globals::config->dictionary_tokens_count);
+    atexit(ReportDictionaryOnExit);
+  }
+
+  // Start collecting statistics, if requested. The report is registered before
+  // the coverage dump, so that it runs after it.
+  if (globals::config->enabled &&
+      globals::config->stats_output != StatsOutput::kNone) {
+    EnableStats();
+    atexit(ReportStatsOnExit);
+  }
+
+  // Register a destructor to save output data if the instrumentation is
+  // enabled.
+  if (globals::config->enabled) {
+    atexit(DumpCoverageOnExit);
+  }
+
+  // Publish the flags checked by the callbacks, which also marks the module as
+  // initialized.
+  uint32_t flags = kFlagInitialized;
+  if (globals::config->enabled) {
+    flags |= kFlagEnabled;
+  }
+  if (globals::config->nonconst_cov_enabled && kNonconstCmpSupported) {
+    flags |= kFlagNonconstCmp;
+  }
+  if (globals::config->memory_cov_enabled && kMemoryCmpSupported) {
+    flags |= kFlagMemoryCmp;
+  }
+  if (globals::config->sampling_threshold != 0) {
+    flags |= kFlagSampling;
+  }
+  if (globals::site_profile != nullptr) {
+    flags |= kFlagProfile;
+  }
+  if (globals::site_denylist != nullptr &&
+      globals::site_denylist->GetSitesCount() != 0) {
+    flags |= kFlagDenylist;
+  }
+  if (globals::module_filter != nullptr) {
+    flags |= kFlagModuleFilter;
+  }
+  if (globals::operand_dictionary != nullptr) {
+    flags |= kFlagDictionary;
+  }
+  globals::flags.store(flags, std::memory_order_release);
+}
+
+// Initializes the module if it hasn't been initialized yet. If |try_lock| is
+// set and cov_mutex is already taken, returns false instead of waiting for it.
+static bool InitializeOnce(bool try_lock) {
+  if (globals::flags.load(std::memory_order_acquire) & kFlagInitialized) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(globals::cov_mutex, std::defer_lock);
+  if (try_lock) {
+    if (!lock.try_lock()) {
+      return false;
+    }
+  } else {
+    lock.lock();
+  }
+
+  Initialize();
+  return true;
+}
+
+// Checks if the instrumentation is enabled, together with all of the features
+// specified by |required_flags|. This is the first thing done by every
+// callback, so in the common case it takes a single load and comparison. The
+// slow path is only taken if a callback is invoked before the startup
+// initializer below.
+static inline bool IsTracingEnabled(uint32_t required_flags, bool try_lock) {
+  required_flags |= kFlagInitialized | kFlagEnabled;
+
+  uint32_t flags = globals::flags.load(std::memory_order_acquire);
+  if ((flags & required_flags) == required_flags) {
+    return true;
+  } else if (flags & kFlagInitialized) {
+    return false;
+  }
+
+  if (!InitializeOnce(try_lock)) {
+    return false;
+  }
+
+  flags = globals::flags.load(std::memory_order_acquire);
+  return (flags & required_flags) == required_flags;
+}
+
+// Initializes the module during the process startup, so that the configuration
+// is parsed before any instrumented code runs in most cases, and doesn't have
+// to be checked under the lock later on.
+#ifdef _WIN32
+static void __cdecl InitializeAtStartup() {
+  InitializeOnce(/*try_lock=*/false);
+}
+
+#pragma section(".CRT$XCU", read)
+__declspec(allocate(".CRT$XCU"))
+static void (__cdecl *initialize_at_startup)(void) = InitializeAtStartup;
+#else
+__attribute__((constructor))
+static void InitializeAtStartup() {
+  InitializeOnce(/*try_lock=*/false);
+}
+#endif
+
+// A scoped object granting the calling thread access to the trace storage for
+// the duration of a single instrumentation callback. In the default mode, the
+// storage is the global Traces object guarded by cov_mutex. In the thread-local
+// mode, it is the thread's own buffer, so that callbacks executed in different
+// threads don't contend for a single lock. The access is only acquired once it
+// is needed, so callbacks which don't produce any new traces take no locks.
+class CallbackScope {
+ public:
+  // If |try_lock| is set, the scope doesn't wait for a lock which is already
+  // taken. In the default mode, this is how reentry from cmpcov itself is
+  // detected.
+  explicit CallbackScope(bool try_lock)
+    : try_lock_(try_lock), attempted_(false), entered_(false),
+      thread_traces_(nullptr) { }
+  ~CallbackScope();
+
+  // Acquires access to the trace storage, unless it has already been acquired.
+  // Returns false if the callback shouldn't proceed, e.g. because of reentry.
+  bool Acquire();
+
+  // Saves an execution trace in the storage assigned to the callback.
+  void TrySaveTrace(size_t pc, int trace_arg1, int trace_arg2) {
+    if (thread_traces_ != nullptr) {
+      thread_traces_->TrySaveTrace(pc, trace_arg1, trace_arg2);
+    } else {
+      globals::traces->TrySaveTrace(pc, trace_arg1, trace_arg2);
+    }
+  }
+
+  // Saves a series of execution traces in the storage assigned to the callback,
+  // see Traces::TrySaveTraces.
+  void TrySaveTraces(size_t pc, int trace_arg1, int trace_arg2, int count,
+                     Traces::DepthArg depth_arg) {
+    if (thread_traces_ != nullptr) {
+      thread_traces_->TrySaveTraces(pc, trace_arg1, trace_arg2, count,
+                                    depth_arg);
+    } else {
+      globals::traces->TrySaveTraces(pc, trace_arg1, trace_arg2, count,
+                                     depth_arg);
+    }
+  }
+
+ private:
+  static bool AcquireLock(std::unique_lock<std::mutex> *lock, bool try_lock) {
+    if (lock->try_lock()) {
+      return true;
+    } else if (try_lock) {
+      CountStat(kStatLockBusySkipped);
+      return false;
+    }
+
+    if (!StatsEnabled()) {
+      lock->lock();
+      return true;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    lock->lock();
+    CountStat(kStatLockContended);
+    CountStat(kStatLockWaitNs,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start).count());
+    return true;
+  }
+
+  const bool try_lock_;
+  bool attempted_;
+  bool entered_;
+  std::unique_lock<std::mutex> lock_;
+  ThreadTraces *thread_traces_;
+};
+
+bool CallbackScope::Acquire() {
+  if (attempted_) {
+    return lock_.owns_lock();
+  }
+  attempted_ = true;
+
+  if (!globals::config->thread_local_traces) {
+    lock_ = std::unique_lock<std::mutex>(globals::cov_mutex, std::defer_lock);
+    if (!AcquireLock(&lock_, try_lock_)) {
+      return false;
+    }
+
+    // Mark the thread for the comparison hooks, see tls::in_cmpcov.
+    if (!tls::in_cmpcov) {
+      tls::in_cmpcov = true;
+      entered_ = true;
+    }
+    return true;
+  }
+
+  // In the thread-local mode, reentry is detected with a per-thread flag, as
+  // cmpcov code running outside of the callbacks doesn't hold the buffer locks.
+  if (tls::in_cmpcov) {
+    return false;
+  }
+  tls::in_cmpcov = true;
+  entered_ = true;
+
+  thread_traces_ = GetThreadTraces();
+  lock_ = std::unique_lock<std::mutex>(thread_traces_->mutex(),
+                                       std::defer_lock);
+  return AcquireLock(&lock_, /*try_lock=*/false);
+}
+
+CallbackScope::~CallbackScope() {
+  if (entered_) {
+    tls::in_cmpcov = false;
+  }
+}
+
+// Returns the maximum length of instrumented memory comparisons, which depends
+// on the long comparison mode. The module must be initialized.
+static inline size_t GetMaxDataCmpLength() {
+  return std::max(kMaxDataCmpLength, globals::config->long_cmp_length);
+}
+
+// The buffers of memory comparisons are scanned in chunks of kScanChunkSize
+// bytes with the widest vector instructions available at build time. The chunk
+// masks (see GetChunkMismatchMask) hold 1 << kScanMaskShift bits per byte.
+#if defined(__AVX2__)
+#define CMPCOV_VECTOR_SCAN
+const size_t kScanChunkSize = 32;
+const int kScanMaskShift = 0;
+#elif defined(__SSE2__)
+#define CMPCOV_VECTOR_SCAN
+const size_t kScanChunkSize = 16;
+const int kScanMaskShift = 0;
+#elif defined(__ARM_NEON)
+#define CMPCOV_VECTOR_SCAN
+const size_t kScanChunkSize = 16;
+const int kScanMaskShift = 2;
+#endif
+
+#ifdef CMPCOV_VECTOR_SCAN
+// Returns a mask of the bytes which differ between the chunks at |s1| and |s2|.
+static inline uint64_t GetChunkMismatchMask(const char *s1, const char *s2) {
+#if defined(__AVX2__)
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s1));
+  const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s2));
+  return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+#elif defined(__SSE2__)
+  const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s1));
+  const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s2));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+#else
+  // Narrow the 16-bit lanes of the comparison result to 4 bits per byte.
+  const uint8x16_t eq =
+      vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(s1)),
+               vld1q_u8(reinterpret_cast<const uint8_t *>(s2)));
+  return ~vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+#endif
+}
+
+// Returns a mask of the bytes which are zero in either of the chunks at |s1|
+// and |s2|.
+static inline uint64_t GetChunkNulMask(const char *s1, const char *s2) {
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s1));
+  const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s2));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero))));
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s1));
+  const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s2));
+  return _mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)));
+#else
+  const uint8x16_t zero = vdupq_n_u8(0);
+  const uint8x16_t nul = vorrq_u8(
+      vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(s1)), zero),
+      vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(s2)), zero));
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(nul), 4)), 0);
+#endif
+}
+
+// Returns the index of the first byte set in a non-zero chunk mask.
+static inline size_t GetFirstMaskedByte(uint64_t mask) {
+  return CountTrailingZeros64(mask) >> kScanMaskShift;
+}
+
+// Checks if a whole chunk can be read at |s| without crossing a page boundary,
+// i.e. without touching a page that the string may not extend to.
+static inline bool IsChunkInPage(const char *s) {
+  const size_t kPageSize = 4096;
+  return (reinterpret_cast<uintptr_t>(s) & (kPageSize - 1)) <=
+         kPageSize - kScanChunkSize;
+}
+#endif  // CMPCOV_VECTOR_SCAN
+
+// Returns the length of the common prefix of two buffers of |length| bytes,
+// comparing whole vector chunks at a time if possible, and then 8 bytes at a
+// time. The word-sized comparison assumes a little-endian architecture.
+static size_t CountMatchingPrefix(const char *s1, const char *s2,
+                                  size_t length) {
+  size_t i = 0;
+#ifdef CMPCOV_VECTOR_SCAN
+  for (; i + kScanChunkSize <= length; i += kScanChunkSize) {
+    const uint64_t mismatch_mask = GetChunkMismatchMask(s1 + i, s2 + i);
+    if (mismatch_mask != 0) {
+      return i + GetFirstMaskedByte(mismatch_mask);
+    }
+  }
+#endif
+  for (; i + 8 <= length; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, s1 + i, sizeof(a));
+    memcpy(&b, s2 + i, sizeof(b));
+    if (a != b) {
+      return i + CountTrailingZeros64(a ^ b) / 8;
+    }
+  }
+  for (; i < length && s1[i] == s2[i]; i++) { }
+  return i;
+}
+
+// Scans two nul-terminated strings in a single pass, and returns the length of
+// the shorter one, capped at |max_length|. The length of their common prefix
+// within that length is saved in |matching_bytes|. The strings are read in
+// vector chunks whenever a chunk doesn't cross a page boundary in either of
+// them, which may read past the terminating nul or |max_length|, but never
+// into a page which doesn't hold any of the string bytes.
+static size_t ScanStrings(const char *s1, const char *s2, size_t max_length,
+                          size_t *matching_bytes) {
+  size_t mismatch = SIZE_MAX;
+  size_t i = 0;
+  while (i < max_length) {
+#ifdef CMPCOV_VECTOR_SCAN
+    if (IsChunkInPage(s1 + i) && IsChunkInPage(s2 + i)) {
+      if (mismatch == SIZE_MAX) {
+        const uint64_t mismatch_mask = GetChunkMismatchMask(s1 + i, s2 + i);
+        if (mismatch_mask != 0) {
+          mismatch = i + GetFirstMaskedByte(mismatch_mask);
+        }
+      }
+
+      const uint64_t nul_mask = GetChunkNulMask(s1 + i, s2 + i);
+      if (nul_mask != 0) {
+        i += GetFirstMaskedByte(nul_mask);
+        break;
+      }
+      i += kScanChunkSize;
+      continue;
+    }
+#endif
+    if (s1[i] == '\0' || s2[i] == '\0') {
+      break;
+    }
+    if (mismatch == SIZE_MAX && s1[i] != s2[i]) {
+      mismatch = i;
+    }
+    i++;
+  }
+
+  const size_t length = std::min(i, max_length);
+  *matching_bytes = std::min(mismatch, length);
+  return length;
+}
+
+// Returns the number of progress milestones within the first |length| bytes of
+// a long memory comparison. Every one of the first kMaxDataCmpLength bytes is a
+// milestone, followed by four milestones evenly spaced in every range between
+// two consecutive powers of two.
+static int CountLongCmpMilestones(size_t length) {
+  if (length <= kMaxDataCmpLength) {
+    return static_cast<int>(length);
+  }
+
+  // log2(kMaxDataCmpLength), the first power of two with spaced milestones.
+  const int kFirstSpacedLog2 = 5;
+
+  const int length_log2 = 63 - __builtin_clzll(length);
+  const size_t range_start = static_cast<size_t>(1) << length_log2;
+  const size_t step = range_start / 4;
+  return static_cast<int>(kMaxDataCmpLength +
+                          (length_log2 - kFirstSpacedLog2) * 4 +
+                          (length - range_start) / step);
+}
+
+static inline int CountMatchingBytes(int count, uint64_t x, uint64_t y) {
+  // The matching bytes are the trailing zero bytes of the XOR of the operands.
+  // The operands are zero-extended, so the result only needs to be capped at
+  // the length of the comparison.
+  return std::min(count, CountTrailingZeros64(x ^ y) / 8);
+}
+
+// Registers and resolves the module containing |pc|, which is outside of all
+// modules resolved so far, e.g. because it has been loaded after the
+// initialization. Returns the verdict of the module filter for the address.
+static ModuleFilter::Verdict ResolveModuleAt(size_t pc) {
+  const ReentryGuard reentry_guard;
+  std::lock_guard<std::mutex> lock(globals::cov_mutex);
+  CountStat(kStatModuleResolves);
+
+  int module_index;
+  size_t offset;
+  globals::traces->TranslateAddress(pc, &module_index, &offset);
+  ResolveNewModules();
+
+  const ModuleFilter::Verdict verdict = globals::module_filter->Check(pc);
+  if (verdict == ModuleFilter::Verdict::kUnknownModule) {
+    return globals::module_filter->GetDefaultVerdict();
+  }
+  return verdict;
+}
+
+// Checks if the site at |pc| belongs to a module accepted by the filter. The
+// filter must be enabled.
+static inline bool IsModuleAccepted(void *pc) {
+  ModuleFilter::Verdict verdict =
+      globals::module_filter->Check(reinterpret_cast<size_t>(pc));
+  if (verdict == ModuleFilter::Verdict::kUnknownModule) {
+    verdict = ResolveModuleAt(reinterpret_cast<size_t>(pc));
+  }
+  return verdict == ModuleFilter::Verdict::kAccepted;
+}
+
+// Checks if the comparison site should be evaluated in the current execution,
+// according to the module filter, the denylist and the sampling policy. The
+// executions which pass the filter and the denylist are also counted in the
+// profile.
+static inline bool ShouldEvaluateSite(void *pc) {
+  const uint32_t flags = globals::flags.load(std::memory_order_relaxed);
+  if (!(flags & (kFlagSampling | kFlagProfile | kFlagDenylist |
+                 kFlagModuleFilter))) {
+    return true;
+  }
+
+  if ((flags & kFlagModuleFilter) && !IsModuleAccepted(pc)) {
+    CountStat(kStatModuleFilterSkipped);
+    return false;
+  }
+
+  if ((flags & kFlagDenylist) &&
+      globals::site_denylist->Contains(reinterpret_cast<size_t>(pc))) {
+    CountStat(kStatDenylistSkipped);
+    return false;
+  }
+
+  if (flags & kFlagProfile) {
+    globals::site_profile->Count(reinterpret_cast<size_t>(pc));
+  }
+
+  if (!(flags & kFlagSampling)) {
+    return true;
+  }
+
+  if (!tls::site_throttle) {
+    tls::site_throttle.reset(
+        ArenaNew<SiteThrottle>(globals::config->sampling_threshold));
+  }
+
+  if (tls::site_throttle->ShouldEvaluate(
+          reinterpret_cast<size_t>(pc),
+          globals::traces_generation.load(std::memory_order_relaxed))) {
+    return true;
+  }
+
+  CountStat(kStatSampledSkipped);
+  return false;
+}
+
+// Checks if the operands of a comparison should be recorded in the dictionary,
+// i.e. if it's enabled and the callback has acquired access to the storage, so
+// that no operands are recorded in a reentry. The site must have been allowed
+// by ShouldEvaluateSite.
+static inline bool ShouldRecordOperands(CallbackScope *scope) {
+  return (globals::flags.load(std::memory_order_relaxed) & kFlagDictionary) &&
+         scope->Acquire();
+}
+
+// Records |length| bytes of a comparison operand at |data| in the dictionary,
+// if it's enabled.
+static inline void RecordOperand(void *pc, const void *data, size_t length,
+                                 CallbackScope *scope) {
+  if (ShouldRecordOperands(scope)) {
+    globals::operand_dictionary->Add(reinterpret_cast<size_t>(pc), data,
+                                     length);
+  }
+}
+
+// Records the operands of a memory comparison of |length| bytes in the
+// dictionary, unless they are equal.
+static void RecordMemcmpOperands(void *pc, const void *s1, const void *s2,
+                                 size_t length, size_t matching_bytes,
+                                 CallbackScope *scope) {
+  if (matching_bytes != length && ShouldRecordOperands(scope)) {
+    globals::operand_dictionary->Add(reinterpret_cast<size_t>(pc), s1, length);
+    globals::operand_dictionary->Add(reinterpret_cast<size_t>(pc), s2, length);
+  }
+}
+
+// Returns the length of the string |s|, at least |known_length| bytes long,
+// capped at |max_length|.
+static inline size_t GetStringLength(const char *s, size_t known_length,
+                                     size_t max_length) {
+  size_t length = known_length;
+  while (length < max_length && s[length] != '\0') {
+    length++;
+  }
+  return length;
+}
+
+// Records the operands of a string comparison of up to |max_length| bytes in
+// the dictionary, unless they are equal. |length| and |matching_bytes| are the
+// results of ScanStrings. Unlike the length of the comparison, the length of
+// each token is that of its own string, so that an expected string is recorded
+// in full even if the input holds a shorter one.
+static void RecordStringOperands(void *pc, const char *s1, const char *s2,
+                                 size_t max_length, size_t length,
+                                 size_t matching_bytes, CallbackScope *scope) {
+  if (!ShouldRecordOperands(scope)) {
+    return;
+  }
+
+  // Both strings are at least |length| bytes long, and unless |length| reaches
+  // the limit, one of them ends right there. Only the rest of the other one
+  // has to be scanned to find its length.
+  max_length = std::min(max_length, kMaxTokenLength);
+  size_t length1 = std::min(length, max_length);
+  size_t length2 = length1;
+  if (length < max_length) {
+    if (s1[length] != '\0') {
+      length1 = GetStringLength(s1, length, max_length);
+    } else if (s2[length] != '\0') {
+      length2 = GetStringLength(s2, length, max_length);
+    }
+  }
+
+  if (length1 != length2 || matching_bytes < length1) {
+    globals::operand_dictionary->Add(reinterpret_cast<size_t>(pc), s1, length1);
+    globals::operand_dictionary->Add(reinterpret_cast<size_t>(pc), s2, length2);
+  }
+}
+
+// Records the outcome of an evaluation of the comparison site, which has been
+// allowed by ShouldEvaluateSite.
+static inline void ReportSiteResult(void *pc, bool progress) {
+  if (!(globals::flags.load(std::memory_order_relaxed) & kFlagSampling)) {
+    return;
+  }
+
+  tls::site_throttle->Report(
+      reinterpret_cast<size_t>(pc),
+      globals::traces_generation.load(std::memory_order_relaxed), progress);
+}
+
+// Saves the traces of an integer comparison. Returns false if the comparison
+// couldn't have produced any new traces.
+static inline bool EvaluateCmpTrace(uint64_t arg1, uint64_t arg2, int arg_length,
+                             int switch_case, void *pc, CallbackScope *scope) {
+  const int matching_bytes = CountMatchingBytes(arg_length, arg1, arg2);
+  if (matching_bytes == 0) {
+    CountStat(kStatNoMatchSkipped);
+    return false;
+  }
+
+  // If the site has already been executed with at least as many matching bytes,
+  // all of the traces below have been recorded, too.
+  const uint64_t site = Traces::ConstructWideTrace(
+      reinterpret_cast<size_t>(pc), arg_length, switch_case);
+  if (globals::saturation_cache->IsSaturated(site, matching_bytes)) {
+    CountStat(kStatSaturatedSkipped);
+    return false;
+  } else if (!scope->Acquire()) {
+    return true;
+  }
+
+  scope->TrySaveTraces(reinterpret_cast<size_t>(pc),
+                       /*trace_arg1=*/arg_length - 1,
+                       /*trace_arg2=*/switch_case,
+                       /*count=*/matching_bytes, Traces::DepthArg::kArg1);
+
+  globals::saturation_cache->Update(site, matching_bytes);
+  return true;
+}
+
+// Returns the length of a comparison of operands of type T. The length of
+// comparisons with a constant is the width of the constant (the first
+// operand), rounded up to full bytes.
+template <typename T, bool kConstant>
+static inline int GetComparisonLength(T arg1) {
+  if (!kConstant || sizeof(T) == 2) {
+    return sizeof(T);
+  } else if (sizeof(T) == 4) {
+    return GetUint32Width(arg1);
+  }
+  return GetUint64Width(arg1);
+}
+
+// Handles the callback of an integer comparison of operands of type T, subject
+// to the sampling policy. The template is instantiated separately for every
+// callback, so that the checks depending on the width and kind of the
+// comparison are resolved at compile time.
+template <typename T, bool kConstant, Stat kCallStat>
+static inline void CommonHandleCmpTrace(T arg1, T arg2, void *pc) {
+  if (!kConstant && !kNonconstCmpSupported) {
+    return;
+  }
+
+  CountStat(kCallStat);
+
+  // Quick initial check if the constant value is wider than a single byte. If
+  // not, we skip the instrumentation of the comparison.
+  if (kConstant && arg1 < 0x100) {
+    CountStat(kStatSmallConstSkipped);
+    return;
+  }
+
+  if (!IsTracingEnabled(kConstant ? 0 : kFlagNonconstCmp, /*try_lock=*/false) ||
+      !ShouldEvaluateSite(pc)) {
+    return;
+  }
+
+  const int length = GetComparisonLength<T, kConstant>(arg1);
+  CallbackScope scope(/*try_lock=*/false);
+  if (kConstant && arg1 != arg2) {
+    RecordOperand(pc, &arg1, length, &scope);
+  }
+
+  const bool progress =
+      EvaluateCmpTrace(arg1, arg2, length, /*switch_case=*/0, pc, &scope);
+  ReportSiteResult(pc, progress);
+}
+
+// Saves the traces of a memory comparison of |length| bytes, the first
+// |matching_bytes| of which are equal. Returns false if the comparison couldn't
+// have produced any new traces.
+static bool EvaluateMemcmpTrace(int length, int matching_bytes, void *pc,
+                                CallbackScope *scope) {
+  if (matching_bytes == 0) {
+    CountStat(kStatNoMatchSkipped);
+    return false;
+  }
+
+  const uint64_t site = Traces::ConstructWideTrace(
+      reinterpret_cast<size_t>(pc), kMemcmpTraceArg1, length);
+  if (globals::saturation_cache->IsSaturated(site, matching_bytes)) {
+    CountStat(kStatSaturatedSkipped);
+    return false;
+  } else if (!scope->Acquire()) {
+    return true;
+  }
+
+  scope->TrySaveTraces(reinterpret_cast<size_t>(pc),
+                       /*trace_arg1=*/kMemcmpTraceArg1,
+                       /*trace_arg2=*/length - 1,
+                       /*count=*/matching_bytes, Traces::DepthArg::kArg2);
+
+  globals::saturation_cache->Update(site, matching_bytes);
+  return true;
+}
+
+// Saves the traces of a memory comparison longer than kMaxDataCmpLength, with
+// one trace per reached milestone (see CountLongCmpMilestones). Returns false
+// if the comparison couldn't have produced any new traces.
+static bool EvaluateLongMemcmpTrace(int length, int matching_bytes, void *pc,
+                                    CallbackScope *scope) {
+  const int milestones = CountLongCmpMilestones(length);
+  const int reached_milestones = CountLongCmpMilestones(matching_bytes);
+
+  if (reached_milestones == 0) {
+    CountStat(kStatNoMatchSkipped);
+    return false;
+  }
+
+  const uint64_t site = Traces::ConstructWideTrace(
+      reinterpret_cast<size_t>(pc), kLongMemcmpTraceArg1, milestones);
+  if (globals::saturation_cache->IsSaturated(site, reached_milestones)) {
+    CountStat(kStatSaturatedSkipped);
+    return false;
+  } else if (!scope->Acquire()) {
+    return true;
+  }
+
+  scope->TrySaveTraces(reinterpret_cast<size_t>(pc),
+                       /*trace_arg1=*/kLongMemcmpTraceArg1,
+                       /*trace_arg2=*/milestones - 1,
+                       /*count=*/reached_milestones, Traces::DepthArg::kArg2);
+
+  globals::saturation_cache->Update(site, reached_milestones);
+  return true;
+}
+
+// Handles a memory comparison of |length| bytes with |matching_bytes| equal
+// bytes at the beginning. The site must have been allowed by
+// ShouldEvaluateSite before the buffers were scanned.
+static void CommonHandleMemcmpTrace(size_t length, size_t matching_bytes,
+                                    void *pc, CallbackScope *scope) {
+  bool progress;
+  if (length > kMaxDataCmpLength) {
+    progress = EvaluateLongMemcmpTrace(length, matching_bytes, pc, scope);
+  } else {
+    progress = EvaluateMemcmpTrace(length, matching_bytes, pc, scope);
+  }
+  ReportSiteResult(pc, progress);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Declarations of SanitizerCoverage callback functions invoked before every
+// executed comparison in the program.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+
+void __sanitizer_cov_trace_cmp1(uint8_t Arg1, uint8_t Arg2) {
+  // Single-byte comparisons are not instrumented. It is assumed that fuzzers
+  // typically operate on byte granularity and are able to eventually guess the
+  // value of a byte in the input stream. Performing cmp instrumentation on a
+  // bit-level could unnecessarily bloat the size of the coverage information
+  // log.
+}
+
+void __sanitizer_cov_trace_cmp2(uint16_t Arg1, uint16_t Arg2) {
+  CommonHandleCmpTrace<uint16_t, /*kConstant=*/false, kStatCmp2Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_cmp4(uint32_t Arg1, uint32_t Arg2) {
+  CommonHandleCmpTrace<uint32_t, /*kConstant=*/false, kStatCmp4Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_cmp8(uint64_t Arg1, uint64_t Arg2) {
+  CommonHandleCmpTrace<uint64_t, /*kConstant=*/false, kStatCmp8Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_const_cmp1(uint8_t Arg1, uint8_t Arg2) {
+  // Single-byte comparisons are not instrumented. It is assumed that fuzzers
+  // typically operate on byte granularity and are able to eventually guess the
+  // value of a byte in the input stream. Performing cmp instrumentation on a
+  // bit-level could unnecessarily bloat the size of the coverage information
+  // log.
+}
+
+void __sanitizer_cov_trace_const_cmp2(uint16_t Arg1, uint16_t Arg2) {
+  CommonHandleCmpTrace<uint16_t, /*kConstant=*/true, kStatConstCmp2Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_const_cmp4(uint32_t Arg1, uint32_t Arg2) {
+  CommonHandleCmpTrace<uint32_t, /*kConstant=*/true, kStatConstCmp4Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_const_cmp8(uint64_t Arg1, uint64_t Arg2) {
+  CommonHandleCmpTrace<uint64_t, /*kConstant=*/true, kStatConstCmp8Calls>(
+      Arg1, Arg2, __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_switch(uint64_t Val, uint64_t *Cases) {
+  CountStat(kStatSwitchCalls);
+
+  // If there are no cases in the switch() construct (possibly because we
+  // overwrote it earlier to prevent this switch from being processed again),
+  // return immediately.
+  if (Cases[0] == 0) {
+    CountStat(kStatEmptySwitchSkipped);
+    return;
+  }
+
+  if (!IsTracingEnabled(/*required_flags=*/0, /*try_lock=*/false)) {
+    return;
+  }
+
+  void *pc = __builtin_return_address(0);
+  if (!ShouldEvaluateSite(pc)) {
+    return;
+  }
+
+  CallbackScope scope(/*try_lock=*/false);
+
   // From SanitizerCoverage documentation:
   //
   // Val is the switch operand.
@@ -471,22 +2162,51 @@ void __sanitizer_cov_trace_switch(uint64_t Val, uint64_t *Cases) {
   // Cases[1] is the size of Val in bits.
   // Cases[2:] are the case constants.
   bool wide_value_found = false;
-  for (int i = 0; i < Cases[0]; i++) {
-    // Similarly to regular cmp instructions, we're not interested in
-    // instrumenting switch cases with 1-byte constants.
-    if (Cases[2 + i] < 0x100) {
-      continue;
+  bool progress = false;
+
+  // Visit only the wide cases found when the switch was first executed, if it
+  // has been cached. Otherwise, scan all of the cases.
+  const SwitchCache::Entry *entry = globals::switch_cache->Get(Cases);
+  if (entry != nullptr) {
+    wide_value_found = !entry->wide_cases.empty();
+
+    for (const SwitchCache::Case &wide_case : entry->wide_cases) {
+      if (Val != Cases[2 + wide_case.index]) {
+        RecordOperand(pc, &Cases[2 + wide_case.index], wide_case.width,
+                      &scope);
+      }
+      if (EvaluateCmpTrace(/*arg1=*/Val,
+                           /*arg2=*/Cases[2 + wide_case.index],
+                           /*arg_length=*/wide_case.width,
+                           /*switch_case=*/wide_case.index + 1, pc, &scope)) {
+        progress = true;
+      }
     }
+  } else {
+    for (int i = 0; i < Cases[0]; i++) {
+      // Similarly to regular cmp instructions, we're not interested in
+      // instrumenting switch cases with 1-byte constants.
+      if (Cases[2 + i] < 0x100) {
+        continue;
+      }
 
-    wide_value_found = true;
+      wide_value_found = true;
+      if (Val != Cases[2 + i]) {
+        RecordOperand(pc, &Cases[2 + i], GetUint64Width(Cases[2 + i]),
+                      &scope);
+      }
 
-    CommonHandleCmpTrace(/*arg1=*/Val,
-                         /*arg2=*/Cases[2 + i],
-                         /*arg_length=*/GetUint64Width(Cases[2 + i]),
-                         /*switch_case=*/i + 1,
-                         __builtin_return_address(0));
+      if (EvaluateCmpTrace(/*arg1=*/Val,
+                           /*arg2=*/Cases[2 + i],
+                           /*arg_length=*/GetUint64Width(Cases[2 + i]),
+                           /*switch_case=*/i + 1, pc, &scope)) {
+        progress = true;
+      }
+    }
   }
 
+  ReportSiteResult(pc, progress);
+
   // This optimization is based on the fact that the Cases[] arrays are placed
   // by ASAN in r/w memory. We have noticed that 8/16-bit switch() constructs
   // are rounded up to 32 bits, and that a majority of such constructs don't
@@ -501,6 +2221,49 @@ void __sanitizer_cov_trace_switch(uint64_t Val, uint64_t *Cases) {
   }
 }
 
+#ifdef CMPCOV_TRACE_PC_GUARD
+void __sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop) {
+  // The guards are only used to mark the edges already recorded in the current
+  // generation of traces (see below), so they are left zeroed. Defining the
+  // callback overrides the implementation of SanitizerCoverage, which then
+  // doesn't write the edge coverage files of its own.
+  InitializeOnce(/*try_lock=*/false);
+}
+
+void __sanitizer_cov_trace_pc_guard(uint32_t *guard) {
+  CountStat(kStatPcGuardCalls);
+
+  // Every edge is recorded once per generation of the traces, after which its
+  // guard holds the generation plus one, so that zeroed guards never match.
+  // Advancing the generation on a reset thus re-arms all of the edges.
+  const uint32_t mark =
+      globals::traces_generation.load(std::memory_order_relaxed) + 1;
+  if (*guard == mark ||
+      !IsTracingEnabled(/*required_flags=*/0, /*try_lock=*/false)) {
+    return;
+  }
+
+  // The edges are subject to the module filter, but not to the policies of
+  // comparison sites, as every edge is only evaluated once anyway.
+  void *pc = __builtin_return_address(0);
+  if ((globals::flags.load(std::memory_order_relaxed) & kFlagModuleFilter) &&
+      !IsModuleAccepted(pc)) {
+    CountStat(kStatModuleFilterSkipped);
+    *guard = mark;
+    return;
+  }
+
+  CallbackScope scope(/*try_lock=*/false);
+  if (!scope.Acquire()) {
+    return;
+  }
+
+  scope.TrySaveTrace(reinterpret_cast<size_t>(pc),
+                     /*trace_arg1=*/kEdgeTraceArg1, /*trace_arg2=*/0);
+  *guard = mark;
+}
+#endif  // CMPCOV_TRACE_PC_GUARD
+
 void __sanitizer_cov_trace_div4(uint32_t Val) {
   // Division operations are not instrumented, as we don't believe they carry
   // a significant amount of useful information.
@@ -517,88 +2280,125 @@ void __sanitizer_cov_trace_gep(uintptr_t Idx) {
 
 void __sanitizer_weak_hook_memcmp(void *caller_pc, const void *s1,
                                   const void *s2, size_t n, int result) {
-  // Ignore too long data comparisons.
-  if (n > kMaxDataCmpLength) {
+  if (!kMemoryCmpSupported) {
     return;
   }
 
-  // Try to acquire the lock; if the attempt fails, it's most likely a reentry
-  // situation and we should return.
-  //
+  CountStat(kStatMemcmpCalls);
+
   // A reentry could occur while performing string operations in our __sanitizer
   // instrumentation callbacks. We don't want to instrument memcmp() and similar
-  // functions invoked by cmpcov itself.
-  std::unique_lock<std::mutex> lock(globals::cov_mutex, std::try_to_lock);
-  if (!lock.owns_lock()) {
+  // functions invoked by cmpcov itself, nor count them in the site policies, so
+  // the reentry is checked first.
+  if (tls::in_cmpcov) {
     return;
   }
 
-  if (!globals::initialized) {
-    Initialize();
+  // Only try to acquire the locks; if an attempt fails, it's most likely a
+  // reentry situation and we should return.
+  if (!IsTracingEnabled(kFlagMemoryCmp, /*try_lock=*/true)) {
+    return;
   }
-  if (!globals::config->enabled || !globals::config->memory_cov_enabled) {
+
+  // Ignore too long data comparisons.
+  if (n > GetMaxDataCmpLength()) {
+    CountStat(kStatLongDataSkipped);
     return;
   }
 
-  CommonHandleMemcmpTrace(static_cast<const char *>(s1),
-                          static_cast<const char *>(s2),
-                          /*length=*/n, caller_pc);
+  if (!ShouldEvaluateSite(caller_pc)) {
+    return;
+  }
+
+  CallbackScope scope(/*try_lock=*/true);
+  const size_t matching_bytes = CountMatchingPrefix(
+      static_cast<const char *>(s1), static_cast<const char *>(s2), n);
+  RecordMemcmpOperands(caller_pc, s1, s2, n, matching_bytes, &scope);
+  CommonHandleMemcmpTrace(/*length=*/n, matching_bytes, caller_pc, &scope);
 }
 
 void __sanitizer_weak_hook_strncmp(void *caller_pc, const char *s1,
                                    const char *s2, size_t n, int result) {
-  // Ignore too long data comparisons.
-  if (n > kMaxDataCmpLength) {
+  if (!kMemoryCmpSupported) {
     return;
   }
 
-  // Try to acquire the lock; if the attempt fails, it's most likely a reentry
-  // situation and we should return.
-  std::unique_lock<std::mutex> lock(globals::cov_mutex, std::try_to_lock);
-  if (!lock.owns_lock()) {
+  CountStat(kStatStrncmpCalls);
+
+  // Skip the comparisons made by cmpcov itself, see above.
+  if (tls::in_cmpcov) {
     return;
   }
 
-  if (!globals::initialized) {
-    Initialize();
+  // Only try to acquire the locks; if an attempt fails, it's most likely a
+  // reentry situation and we should return.
+  if (!IsTracingEnabled(kFlagMemoryCmp, /*try_lock=*/true)) {
+    return;
   }
-  if (!globals::config->enabled || !globals::config->memory_cov_enabled) {
+
+  // Ignore too long data comparisons.
+  if (n > GetMaxDataCmpLength()) {
+    CountStat(kStatLongDataSkipped);
     return;
   }
 
+  if (!ShouldEvaluateSite(caller_pc)) {
+    return;
+  }
+
+  CallbackScope scope(/*try_lock=*/true);
+
   // This is effectively:
   //
   // n = min(n, strlen(s1), strlen(s2))
-  n = InternalStrnlen(s1, n);
-  n = InternalStrnlen(s2, n);
+  //
+  // together with the number of matching bytes, in a single pass.
+  size_t matching_bytes;
+  const size_t length = ScanStrings(s1, s2, n, &matching_bytes);
 
-  CommonHandleMemcmpTrace(s1, s2, /*length=*/n, caller_pc);
+  RecordStringOperands(caller_pc, s1, s2, n, length, matching_bytes, &scope);
+  CommonHandleMemcmpTrace(length, matching_bytes, caller_pc, &scope);
 }
 
 void __sanitizer_weak_hook_strcmp(void *caller_pc, const char *s1,
                                   const char *s2, int result) {
-  // Try to acquire the lock; if the attempt fails, it's most likely a reentry
-  // situation and we should return.
-  std::unique_lock<std::mutex> lock(globals::cov_mutex, std::try_to_lock);
-  if (!lock.owns_lock()) {
+  if (!kMemoryCmpSupported) {
+    return;
+  }
+
+  CountStat(kStatStrcmpCalls);
+
+  // Skip the comparisons made by cmpcov itself, see above.
+  if (tls::in_cmpcov) {
     return;
   }
 
-  if (!globals::initialized) {
-    Initialize();
+  // Only try to acquire the locks; if an attempt fails, it's most likely a
+  // reentry situation and we should return.
+  if (!IsTracingEnabled(kFlagMemoryCmp, /*try_lock=*/true)) {
+    return;
   }
-  if (!globals::config->enabled || !globals::config->memory_cov_enabled) {
+
+  if (!ShouldEvaluateSite(caller_pc)) {
     return;
   }
 
-  // Calculate min(strlen(s1), strlen(s2)). If both strings are longer than
-  // kMaxDataCmpLength, it's most likely not a comparison we're interested in.
-  const size_t n = InternalStrnlen2(s1, s2, kMaxDataCmpLength + 1);
-  if (n > kMaxDataCmpLength) {
+  CallbackScope scope(/*try_lock=*/true);
+
+  // Calculate min(strlen(s1), strlen(s2)), together with the number of matching
+  // bytes. If both strings are longer than the maximum length, it's most likely
+  // not a comparison we're interested in.
+  const size_t max_length = GetMaxDataCmpLength();
+  size_t matching_bytes;
+  const size_t n = ScanStrings(s1, s2, max_length + 1, &matching_bytes);
+  if (n > max_length) {
+    CountStat(kStatLongDataSkipped);
     return;
   }
 
-  CommonHandleMemcmpTrace(s1, s2, /*length=*/n, caller_pc);
+  RecordStringOperands(caller_pc, s1, s2, max_length, n, matching_bytes,
+                       &scope);
+  CommonHandleMemcmpTrace(/*length=*/n, matching_bytes, caller_pc, &scope);
 }
 
 void __sanitizer_weak_hook_strncasecmp(void *called_pc, const char *s1,
@@ -612,3 +2412,80 @@ void __sanitizer_weak_hook_strcasecmp(void *called_pc, const char *s1,
 }
 
 }  // extern "C"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Implementation of the in-process interface declared in cmpcov.h.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Acquires cov_mutex for the duration of an interface call, initializes the
+// module if necessary, and makes sure that all traces are available in the
+// global Traces object.
+static std::unique_lock<std::mutex> LockTraces() {
+  std::unique_lock<std::mutex> lock(globals::cov_mutex);
+
+  Initialize();
+  if (globals::config->thread_local_traces) {
+    MergeThreadTraces();
+  }
+
+  return lock;
+}
+
+extern "C" {
+
+void cmpcov_reset() {
+  const ReentryGuard reentry_guard;
+  std::unique_lock<std::mutex> lock = LockTraces();
+
+  if (globals::config->thread_local_traces) {
+    ResetThreadTraces();
+  }
+  globals::traces->Reset();
+  globals::saturation_cache->Reset();
+  globals::traces_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t cmpcov_get_new_traces(struct cmpcov_trace *traces, size_t capacity) {
+  const ReentryGuard reentry_guard;
+  std::unique_lock<std::mutex> lock = LockTraces();
+
+  const size_t count = globals::traces->GetTracesCount();
+  for (size_t i = 0; i < count && i < capacity; i++) {
+    const auto trace = globals::traces->GetTrace(i);
+    traces[i].module_index = trace.first;
+    traces[i].trace = trace.second;
+  }
+
+  return count;
+}
+
+int cmpcov_next_trace(size_t *cursor, struct cmpcov_trace *trace) {
+  const ReentryGuard reentry_guard;
+  std::unique_lock<std::mutex> lock = LockTraces();
+
+  if (*cursor >= globals::traces->GetTracesCount()) {
+    return 0;
+  }
+
+  const auto next_trace = globals::traces->GetTrace((*cursor)++);
+  trace->module_index = next_trace.first;
+  trace->trace = next_trace.second;
+  return 1;
+}
+
+int cmpcov_get_module_name(int module_index, char *name, size_t size) {
+  const ReentryGuard reentry_guard;
+  std::unique_lock<std::mutex> lock = LockTraces();
+
+  if (module_index < 0 || module_index >= globals::traces->GetModulesCount()) {
+    return 0;
+  }
+
+  snprintf(name, size, "%s",
+           globals::traces->GetModuleName(module_index).c_str());
+  return 1;
+}
+
+}  // extern "C"
@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A C interface for retrieving and resetting the comparison coverage traces
+// from within the instrumented process. It is meant for fuzzers which execute
+// many inputs in a single process (e.g. in a libFuzzer-style loop), and need
+// to collect the traces of every input separately, without restarting the
+// process. A typical iteration looks as follows:
+//
+//   cmpcov_reset();
+//   RunOneInput(data, size);
+//
+//   size_t cursor = 0;
+//   struct cmpcov_trace trace;
+//   while (cmpcov_next_trace(&cursor, &trace)) {
+//     ...
+//   }
+//
+// The traces are only recorded if the instrumentation is enabled with
+// ASAN_OPTIONS=coverage=1. Traces found since the last reset are still written
+// to disk on exit, as usual.
+
+#ifndef CMPCOV_CMPCOV_H_
+#define CMPCOV_CMPCOV_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A single trace found by cmpcov.
+struct cmpcov_trace {
+  // The index of the module in which the trace was found, which can be
+  // translated to the module name with cmpcov_get_module_name().
+  int module_index;
+
+  // The trace, in the same form as it would be written to the .sancov file.
+  size_t trace;
+};
+
+// Forgets all traces found so far, so that every trace is reported again when
+// it occurs next time. The call takes time proportional to the number of traces
+// found since the previous reset.
+void cmpcov_reset(void);
+
+// Copies up to |capacity| traces found since the last reset to |traces|, in the
+// order of discovery. Returns the total number of such traces, which may be
+// larger than |capacity|.
+size_t cmpcov_get_new_traces(struct cmpcov_trace *traces, size_t capacity);
+
+// Retrieves the trace found since the last reset at position |*cursor|, and
+// advances the cursor. The cursor should be initialized to zero before the
+// first call. Returns zero if there are no more traces, and non-zero otherwise.
+int cmpcov_next_trace(size_t *cursor, struct cmpcov_trace *trace);
+
+// Copies the nul-terminated name of the module with the given index to |name|,
+// truncating it if necessary. Returns zero if the index is invalid, and
+// non-zero otherwise.
+int cmpcov_get_module_name(int module_index, char *name, size_t size);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // CMPCOV_CMPCOV_H_
@@ -22,9 +22,11 @@
 #ifdef _WIN32
 #include <windows.h>
 #elif __linux__
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
+#include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 
@@ -44,3 +46,77 @@ int GetPid() {
 #endif
 }
 
+uint64_t HashString(const char *s) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (; *s != '\0'; s++) {
+    hash ^= static_cast<uint8_t>(*s);
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+std::vector<std::string> SplitList(const std::string& list) {
+  std::vector<std::string> result;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      result.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+void WriteFileOrDie(const char *path, const void *data, size_t size,
+                    bool append) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path,
+                            append ? FILE_APPEND_DATA : GENERIC_WRITE, 0, NULL,
+                            append ? OPEN_ALWAYS : CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    Die("Unable to open the \"%s\" file for writing.\n", path);
+  }
+
+  const char *ptr = static_cast<const char *>(data);
+  while (size > 0) {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+    DWORD written;
+    if (!WriteFile(file, ptr, chunk, &written, NULL) || written == 0) {
+      Die("Unable to write to the \"%s\" file.\n", path);
+    }
+    ptr += written;
+    size -= written;
+  }
+
+  CloseHandle(file);
+#elif __linux__
+  int fd = open(path,
+                O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC),
+                0644);
+  if (fd == -1) {
+    Die("Unable to open the \"%s\" file for writing.\n", path);
+  }
+
+  // A single write() is normally enough, but it may be interrupted or cut
+  // short for very large buffers.
+  const char *ptr = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = write(fd, ptr, size);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      Die("Unable to write to the \"%s\" file.\n", path);
+    }
+    ptr += written;
+    size -= written;
+  }
+
+  close(fd);
+#endif
+}
+
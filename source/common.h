@@ -25,8 +25,13 @@
 #define CMPCOV_COMMON_H_
 
 #include <inttypes.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 #ifndef MAX_PATH
 #define MAX_PATH 260
@@ -47,6 +52,26 @@ const uint64_t kMagic64 = 0xC0BFFFFFFFFFFF64ULL;
 const uint64_t kMagic32 = 0xC0BFFFFFFFFFFF32ULL;
 const uint64_t kMagic = WORDSIZE == 64 ? kMagic64 : kMagic32;
 
+// Magic values found at the beginning of files in the compact output format,
+// see compact_format.h.
+const uint64_t kCompactMagic64 = 0xC0BFFFFFFFFFFC64ULL;
+const uint64_t kCompactMagic32 = 0xC0BFFFFFFFFFFC32ULL;
+const uint64_t kCompactMagic =
+    WORDSIZE == 64 ? kCompactMagic64 : kCompactMagic32;
+
+// Magic values found at the beginning of shared memory trace regions, defining
+// the bitness of the traces stored in them.
+const uint64_t kSharedMagic64 = 0xC0BFFFFFFFFF5A64ULL;
+const uint64_t kSharedMagic32 = 0xC0BFFFFFFFFF5A32ULL;
+const uint64_t kSharedMagic = WORDSIZE == 64 ? kSharedMagic64 : kSharedMagic32;
+
+// Magic values found at the beginning of shared memory regions holding the
+// host-wide tables of seen traces, see host_trace_table.h.
+const uint64_t kHostTableMagic64 = 0xC0BFFFFFFFFF7B64ULL;
+const uint64_t kHostTableMagic32 = 0xC0BFFFFFFFFF7B32ULL;
+const uint64_t kHostTableMagic =
+    WORDSIZE == 64 ? kHostTableMagic64 : kHostTableMagic32;
+
 // Maximum length of instrumented string/memory buffers in calls to strcmp(),
 // strncmp() and memcmp().
 const size_t kMaxDataCmpLength = 32;
@@ -56,10 +81,69 @@ const size_t kMaxDataCmpLength = 32;
 // of matching bytes in a single-variable comparison (which is limited to 8).
 const int kMemcmpTraceArg1 = 15;
 
+// Maximum length of instrumented buffers in the long comparison mode (see the
+// TRACE_LONG_CMP_LENGTH option), chosen so that the number of progress
+// milestones in a comparison fits in the saturation cache.
+const size_t kMaxLongDataCmpLength = 4096;
+
+// Argument #1 for traces corresponding to memory comparisons longer than
+// kMaxDataCmpLength. Similarly to kMemcmpTraceArg1, it never appears in traces
+// of single-variable comparisons.
+const int kLongMemcmpTraceArg1 = 14;
+
+// Argument #1 for traces of the edges recorded by the trace-pc-guard callbacks,
+// when they are built in with CMPCOV_TRACE_PC_GUARD. Similarly to the above,
+// the value never appears in the traces of comparisons.
+const int kEdgeTraceArg1 = 13;
+
 // Kills the process instantly on a critical error.
 void Die(const char *format, ...);
 
 // Returns the ID of the current process.
 int GetPid();
 
+// Returns the 64-bit FNV-1a hash of a nul-terminated string.
+uint64_t HashString(const char *s);
+
+// Splits a comma-separated list into its non-empty elements.
+std::vector<std::string> SplitList(const std::string& list);
+
+// Creates (or truncates) the file at |path| and writes |size| bytes of |data|
+// to it with as few system calls as possible. If |append| is set, the data is
+// appended to the existing contents of the file instead. Kills the process on
+// failure.
+void WriteFileOrDie(const char *path, const void *data, size_t size,
+                    bool append);
+
+// Returns the number of trailing zero bits in |x|, or 64 if |x| is zero.
+inline int CountTrailingZeros64(uint64_t x) {
+  if (x == 0) {
+    return 64;
+  }
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+#if WORDSIZE == 64
+  _BitScanForward64(&index, x);
+#else
+  if (!_BitScanForward(&index, static_cast<uint32_t>(x))) {
+    _BitScanForward(&index, static_cast<uint32_t>(x >> 32));
+    index += 32;
+  }
+#endif
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+// Returns the width of a non-zero value in bytes, i.e. the number of bytes
+// needed to store it.
+inline int GetUint32Width(uint32_t x) {
+  return (32 - (__builtin_clz(x) & (~7))) / 8;
+}
+
+inline int GetUint64Width(uint64_t x) {
+  return (64 - (__builtin_clzll(x) & (~7))) / 8;
+}
+
 #endif  // CMPCOV_COMMON_H_
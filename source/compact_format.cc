@@ -0,0 +1,165 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "compact_format.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common.h"
+
+// The size of the header of each block.
+static const size_t kBlockHeaderSize = 2 * sizeof(uint32_t);
+
+template <typename ByteVector>
+static void AppendVarint(uint64_t value, ByteVector *output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  output->push_back(static_cast<uint8_t>(value));
+}
+
+static bool ReadVarint(const uint8_t **data, const uint8_t *end,
+                       uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*data == end) {
+      return false;
+    }
+
+    const uint8_t byte = *(*data)++;
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T, typename ByteVector>
+static void AppendRaw(T value, ByteVector *output) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+  output->insert(output->end(), bytes, bytes + sizeof(value));
+}
+
+template <typename TraceVector, typename ByteVector>
+static void EncodeTraces(uint64_t magic, TraceVector *traces,
+                         ByteVector *output) {
+  std::sort(traces->begin(), traces->end());
+
+  AppendRaw<uint64_t>(magic, output);
+  AppendRaw<uint64_t>(traces->size(), output);
+
+  for (size_t i = 0; i < traces->size(); i += kCompactBlockTraces) {
+    const size_t block_end = std::min(traces->size(), i + kCompactBlockTraces);
+
+    // Reserve space for the header, and fill it in once the payload is known.
+    const size_t header_offset = output->size();
+    output->resize(header_offset + kBlockHeaderSize);
+
+    AppendVarint((*traces)[i], output);
+    for (size_t j = i + 1; j < block_end; j++) {
+      AppendVarint((*traces)[j] - (*traces)[j - 1], output);
+    }
+
+    const uint32_t header[2] = {
+      static_cast<uint32_t>(block_end - i),
+      static_cast<uint32_t>(output->size() - header_offset - kBlockHeaderSize)
+    };
+    memcpy(&(*output)[header_offset], header, sizeof(header));
+  }
+}
+
+// Decodes a file whose magic value has already been checked by the caller.
+template <typename TraceVector>
+static bool DecodeTraces(const uint8_t *data, size_t size,
+                         TraceVector *traces) {
+  uint64_t traces_count;
+  memcpy(&traces_count, data + sizeof(uint64_t), sizeof(traces_count));
+
+  const uint8_t *ptr = data + sizeof(uint64_t) + sizeof(traces_count);
+  const uint8_t *end = data + size;
+  uint64_t decoded_count = 0;
+
+  while (ptr != end) {
+    uint32_t header[2];
+    if (end - ptr < sizeof(header)) {
+      return false;
+    }
+    memcpy(header, ptr, sizeof(header));
+    ptr += sizeof(header);
+
+    const uint32_t block_traces = header[0];
+    const uint32_t payload_size = header[1];
+    if (block_traces == 0 || block_traces > kCompactBlockTraces ||
+        end - ptr < payload_size) {
+      return false;
+    }
+
+    const uint8_t *payload_end = ptr + payload_size;
+    uint64_t trace = 0;
+    for (uint32_t i = 0; i < block_traces; i++) {
+      uint64_t value;
+      if (!ReadVarint(&ptr, payload_end, &value)) {
+        return false;
+      }
+      trace = (i == 0) ? value : trace + value;
+      traces->push_back(
+          static_cast<typename TraceVector::value_type>(trace));
+    }
+
+    if (ptr != payload_end) {
+      return false;
+    }
+    decoded_count += block_traces;
+  }
+
+  return decoded_count == traces_count;
+}
+
+void EncodeCompactTraces(ArenaVector<size_t> *traces,
+                         ArenaVector<uint8_t> *output) {
+  EncodeTraces(kCompactMagic, traces, output);
+}
+
+bool DecodeCompactTraces(const uint8_t *data, size_t size,
+                         ArenaVector<size_t> *traces) {
+  uint64_t magic;
+  if (size < 2 * sizeof(uint64_t)) {
+    return false;
+  }
+  memcpy(&magic, data, sizeof(magic));
+  return magic == kCompactMagic && DecodeTraces(data, size, traces);
+}
+
+void EncodeCompactTraces64(uint64_t magic, std::vector<uint64_t> *traces,
+                           std::vector<uint8_t> *output) {
+  EncodeTraces(magic, traces, output);
+}
+
+bool DecodeCompactTraces64(const uint8_t *data, size_t size, uint64_t *magic,
+                           std::vector<uint64_t> *traces) {
+  if (size < 2 * sizeof(uint64_t)) {
+    return false;
+  }
+  memcpy(magic, data, sizeof(*magic));
+  return (*magic == kCompactMagic64 || *magic == kCompactMagic32) &&
+         DecodeTraces(data, size, traces);
+}
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// Encoder and decoder of the compact output format, an alternative to the
+// .sancov format which takes considerably less space. The file starts with
+// a 64-bit magic value (kCompactMagic64 or kCompactMagic32), followed by the
+// 64-bit total number of traces in the file, and a sequence of blocks until
+// the end of the file. Each block consists of:
+//
+//   uint32_t traces_count;  // Number of traces in the block, at most 256.
+//   uint32_t payload_size;  // Size of the payload in bytes.
+//   uint8_t payload[];      // LEB128-encoded traces.
+//
+// The traces are sorted in ascending order throughout the file. The payload of
+// each block holds the first trace of the block, followed by the differences
+// between the consecutive traces, so that the blocks can be decoded
+// independently of each other.
+
+#ifndef CMPCOV_COMPACT_FORMAT_H_
+#define CMPCOV_COMPACT_FORMAT_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "arena.h"
+
+// The maximum number of traces in a single block of a compact file.
+const size_t kCompactBlockTraces = 256;
+
+// Sorts the traces and appends their compact representation, including the
+// header, to |output|.
+void EncodeCompactTraces(ArenaVector<size_t> *traces,
+                         ArenaVector<uint8_t> *output);
+
+// Decodes the contents of a compact file and appends the traces to |traces|.
+// Returns false if the data is malformed, or has a different bitness than the
+// current program.
+bool DecodeCompactTraces(const uint8_t *data, size_t size,
+                         ArenaVector<size_t> *traces);
+
+// Variants of the above independent of the bitness of the current program,
+// used by tools processing files of both widths, which use the global
+// allocator. The encoder writes the specified magic value, and the decoder
+// accepts both kCompactMagic64 and kCompactMagic32, storing the one found in
+// the file in |magic|.
+void EncodeCompactTraces64(uint64_t magic, std::vector<uint64_t> *traces,
+                           std::vector<uint8_t> *output);
+bool DecodeCompactTraces64(const uint8_t *data, size_t size, uint64_t *magic,
+                           std::vector<uint64_t> *traces);
+
+#endif  // CMPCOV_COMPACT_FORMAT_H_
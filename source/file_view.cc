@@ -0,0 +1,93 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file_view.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+FileView::FileView(const char *path) : data_(nullptr), size_(0) {
+#ifdef _WIN32
+  file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    Die("[-] Unable to open the \"%s\" file.\n", path);
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_, &file_size)) {
+    Die("[-] Unable to query the size of the \"%s\" file.\n", path);
+  }
+  size_ = static_cast<size_t>(file_size.QuadPart);
+
+  mapping_ = NULL;
+  if (size_ != 0) {
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_ == NULL) {
+      Die("[-] Unable to map the \"%s\" file.\n", path);
+    }
+    data_ = static_cast<const uint8_t *>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (data_ == NULL) {
+      Die("[-] Unable to map the \"%s\" file.\n", path);
+    }
+  }
+#else
+  fd_ = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd_ == -1) {
+    Die("[-] Unable to open the \"%s\" file.\n", path);
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    Die("[-] Unable to query the size of the \"%s\" file.\n", path);
+  }
+  size_ = st.st_size;
+
+  if (size_ != 0) {
+    void *data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data == MAP_FAILED) {
+      Die("[-] Unable to map the \"%s\" file.\n", path);
+    }
+    data_ = static_cast<const uint8_t *>(data);
+  }
+#endif
+}
+
+FileView::~FileView() {
+#ifdef _WIN32
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != NULL) {
+    CloseHandle(mapping_);
+  }
+  CloseHandle(file_);
+#else
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+  close(fd_);
+#endif
+}
@@ -0,0 +1,56 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A read-only memory mapping of a whole file, used to read .sancov files
+// without copying their contents. Files of zero size are not mapped, and have
+// a null data pointer.
+
+#ifndef CMPCOV_FILE_VIEW_H_
+#define CMPCOV_FILE_VIEW_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+
+class FileView {
+ public:
+  // Maps the file at |path|. Kills the process on failure.
+  explicit FileView(const char *path);
+  ~FileView();
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#else
+  int fd_;
+#endif
+  const uint8_t *data_;
+  size_t size_;
+};
+
+#endif  // CMPCOV_FILE_VIEW_H_
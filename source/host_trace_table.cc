@@ -0,0 +1,105 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "host_trace_table.h"
+
+#include "common.h"
+#include "shared_traces.h"
+
+// The maximum number of slots probed for a single trace.
+static const size_t kMaxProbes = 32;
+
+// The tag of a slot claimed by a process which hasn't written the trace yet.
+static const uint64_t kHostTableBusyTag = 2;
+
+// The maximum number of times the tag of a busy slot is re-read, after which
+// the slot is skipped, e.g. if its writer has been killed in the meantime.
+static const int kMaxBusyWaits = 1000;
+
+HostTraceTable::HostTraceTable(const char *id) {
+  size_t region_size;
+  void *region = AttachSharedRegion(id, &region_size);
+  if (region_size <
+      sizeof(HostTraceTableHeader) + sizeof(HostTraceTableSlot)) {
+    Die("The shared memory region \"%s\" is too small (%zu bytes).\n",
+        id, region_size);
+  }
+
+  header_ = static_cast<HostTraceTableHeader *>(region);
+  slots_ = reinterpret_cast<HostTraceTableSlot *>(header_ + 1);
+
+  // All processes compute the same capacity from the size of the region, so
+  // they may initialize the header concurrently.
+  const uint64_t max_slots =
+      (region_size - sizeof(HostTraceTableHeader)) / sizeof(HostTraceTableSlot);
+  uint64_t capacity = 1;
+  while (capacity * 2 <= max_slots) {
+    capacity *= 2;
+  }
+  header_->capacity = capacity;
+
+  uint64_t magic = 0;
+  if (!header_->magic.compare_exchange_strong(magic, kHostTableMagic) &&
+      magic != kHostTableMagic) {
+    Die("The shared memory region \"%s\" holds traces of a different "
+        "bitness.\n", id);
+  }
+}
+
+bool HostTraceTable::Insert(uint64_t module_id, size_t trace) {
+  const uint64_t tag = module_id | 1;
+
+  // The finalizer of MurmurHash3, mixing the module and the trace into the
+  // index of the first probed slot.
+  uint64_t hash = module_id ^ (static_cast<uint64_t>(trace) *
+                               0x9E3779B97F4A7C15ULL);
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+
+  const uint64_t mask = header_->capacity - 1;
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    HostTraceTableSlot *slot = &slots_[(hash + i) & mask];
+
+    uint64_t slot_tag = slot->tag.load(std::memory_order_acquire);
+    if (slot_tag == 0 &&
+        slot->tag.compare_exchange_strong(slot_tag, kHostTableBusyTag,
+                                          std::memory_order_acquire)) {
+      slot->trace.store(trace, std::memory_order_relaxed);
+      slot->tag.store(tag, std::memory_order_release);
+      header_->count.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // Either the slot was already taken, or another process has just taken it,
+    // possibly for the same trace, in which case it has to be written first.
+    for (int j = 0; slot_tag == kHostTableBusyTag && j < kMaxBusyWaits; j++) {
+      slot_tag = slot->tag.load(std::memory_order_acquire);
+    }
+
+    if (slot_tag == tag &&
+        slot->trace.load(std::memory_order_relaxed) == trace) {
+      return false;
+    }
+  }
+
+  header_->overflow.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A table of the traces seen by all instrumented processes on the host, kept
+// in a shared memory region created by the fuzzer, e.g. shared by parallel
+// fuzzing workers of the same target. Traces found there are treated as
+// already seen, so every worker only reports the traces which are new to the
+// whole host.
+//
+// The region is identified the same way as the shared memory output (see
+// shared_traces.h), and must be zero-filled when it is created. It starts with
+// a HostTraceTableHeader structure, followed by an open-addressing table of
+// HostTraceTableSlot structures filling the rest of the region, rounded down to
+// a power of two. Every slot holds the trace in the form saved in the .sancov
+// file, together with a tag derived from the FNV-1a hash of the module name, so
+// that it doesn't depend on the load addresses of the modules in the particular
+// processes. As the traces are compared in full, two different traces of a
+// module are never mistaken for each other; traces of different modules only
+// are if the hashes of the module names collide.
+//
+// The slots are claimed with atomic compare-and-swap operations on the tags
+// without any locking, and are never removed; the fuzzer may clear the region
+// to start over. Traces which can't be inserted within a bounded number of
+// probes are always treated as new, and accounted for in the overflow field.
+
+#ifndef CMPCOV_HOST_TRACE_TABLE_H_
+#define CMPCOV_HOST_TRACE_TABLE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+struct HostTraceTableHeader {
+  // kHostTableMagic64 or kHostTableMagic32, depending on the bitness of the
+  // traces.
+  std::atomic<uint64_t> magic;
+
+  // The number of slots in the table, a power of two.
+  uint64_t capacity;
+
+  // The number of keys inserted into the table so far.
+  std::atomic<uint64_t> count;
+
+  // The number of traces which couldn't be inserted into the table.
+  std::atomic<uint64_t> overflow;
+};
+
+struct HostTraceTableSlot {
+  // The tag of the module of the trace, which is always odd, zero for an empty
+  // slot, or 2 while the trace is being written.
+  std::atomic<uint64_t> tag;
+
+  // The trace, valid once the tag is set.
+  std::atomic<uint64_t> trace;
+};
+
+class HostTraceTable {
+ public:
+  // Attaches to the shared memory region identified by |id|. Kills the process
+  // if the region doesn't exist, is too small, or is used for traces of
+  // different bitness.
+  explicit HostTraceTable(const char *id);
+
+  // Inserts the trace of the module identified by |module_id| into the table.
+  // Returns true if it's new to the host (or doesn't fit in the table), and
+  // false if any process has inserted it before.
+  bool Insert(uint64_t module_id, size_t trace);
+
+ private:
+  HostTraceTableHeader *header_;
+  HostTraceTableSlot *slots_;
+};
+
+#endif  // CMPCOV_HOST_TRACE_TABLE_H_
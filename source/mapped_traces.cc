@@ -0,0 +1,178 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "mapped_traces.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+#include "common.h"
+
+// The size by which the output files are initially extended, and the minimum
+// size by which they grow later. The files are sparse, so the unused part
+// doesn't take any disk space.
+static const size_t kFileSizeIncrement = 1 << 20;
+
+void MappedTraces::AddModule(int module_index, const char *module_name) {
+  if (finalized_) {
+    return;
+  }
+
+  if (module_index >= files_.size()) {
+    files_.resize(module_index + 1);
+  }
+
+  MappedFile *file = &files_[module_index];
+  snprintf(file->path, sizeof(file->path), "%s/cmp.%s.%d.sancov",
+           directory_.c_str(), module_name, GetPid());
+
+#ifdef _WIN32
+  file->file = CreateFileA(file->path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file->file == INVALID_HANDLE_VALUE) {
+    Die("Unable to open the \"%s\" file for writing.\n", file->path);
+  }
+#elif __linux__
+  file->fd = open(file->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file->fd == -1) {
+    Die("Unable to open the \"%s\" file for writing.\n", file->path);
+  }
+#endif
+
+  MapFile(file, kFileSizeIncrement);
+
+  memcpy(file->data, &kMagic, sizeof(kMagic));
+  file->size = sizeof(kMagic);
+}
+
+void MappedTraces::Append(int module_index, size_t trace) {
+  if (finalized_) {
+    return;
+  }
+
+  MappedFile *file = &files_[module_index];
+  if (file->size + sizeof(trace) > file->capacity) {
+    UnmapFile(file);
+    MapFile(file, file->capacity * 2);
+  }
+
+  memcpy(&file->data[file->size], &trace, sizeof(trace));
+  file->size += sizeof(trace);
+}
+
+void MappedTraces::Finalize() {
+  if (finalized_) {
+    return;
+  }
+  finalized_ = true;
+
+  for (auto& file : files_) {
+    if (file.data == nullptr) {
+      continue;
+    }
+
+    UnmapFile(&file);
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = file.size;
+    if (!SetFilePointerEx(file.file, size, NULL, FILE_BEGIN) ||
+        !SetEndOfFile(file.file)) {
+      Die("Unable to truncate the \"%s\" file.\n", file.path);
+    }
+    CloseHandle(file.file);
+#elif __linux__
+    if (ftruncate(file.fd, file.size) != 0) {
+      Die("Unable to truncate the \"%s\" file.\n", file.path);
+    }
+    close(file.fd);
+#endif
+
+    fprintf(stderr, "CmpSanitizerCoverage: %s: %zu PCs written\n",
+            file.path, (file.size - sizeof(kMagic)) / sizeof(size_t));
+  }
+}
+
+void MappedTraces::Detach() {
+  finalized_ = true;
+
+  for (auto& file : files_) {
+    if (file.data == nullptr) {
+      continue;
+    }
+
+    UnmapFile(&file);
+
+#ifdef _WIN32
+    CloseHandle(file.file);
+#elif __linux__
+    close(file.fd);
+#endif
+  }
+}
+
+void MappedTraces::MapFile(MappedFile *file, size_t capacity) {
+#ifdef _WIN32
+  // Creating a mapping larger than the file extends the file.
+  file->mapping = CreateFileMappingA(
+      file->file, NULL, PAGE_READWRITE,
+      static_cast<DWORD>(static_cast<uint64_t>(capacity) >> 32),
+      static_cast<DWORD>(capacity), NULL);
+  if (file->mapping == NULL) {
+    Die("Unable to create a mapping of the \"%s\" file.\n", file->path);
+  }
+
+  file->data = static_cast<uint8_t *>(
+      MapViewOfFile(file->mapping, FILE_MAP_ALL_ACCESS, 0, 0, capacity));
+  if (file->data == NULL) {
+    Die("Unable to map the \"%s\" file.\n", file->path);
+  }
+#elif __linux__
+  if (ftruncate(file->fd, capacity) != 0) {
+    Die("Unable to extend the \"%s\" file.\n", file->path);
+  }
+
+  void *data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    file->fd, 0);
+  if (data == MAP_FAILED) {
+    Die("Unable to map the \"%s\" file.\n", file->path);
+  }
+  file->data = static_cast<uint8_t *>(data);
+#endif
+
+  file->capacity = capacity;
+}
+
+void MappedTraces::UnmapFile(MappedFile *file) {
+#ifdef _WIN32
+  UnmapViewOfFile(file->data);
+  CloseHandle(file->mapping);
+#elif __linux__
+  munmap(file->data, file->capacity);
+#endif
+  file->data = nullptr;
+}
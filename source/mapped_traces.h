@@ -0,0 +1,111 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// An output channel which saves new traces to per-module .sancov files mapped
+// into memory, as soon as they are discovered. The mappings are backed by the
+// page cache, so the traces are persisted by the kernel even if the process
+// crashes, is killed, or exits without running the atexit handlers.
+//
+// The files have the same format as the ones written at exit, but they are
+// extended ahead of time in large chunks, and only truncated to the actual size
+// of the data at a clean exit. Files left behind by an abnormal termination may
+// thus end with a number of zero entries, which should be ignored by readers.
+
+#ifndef CMPCOV_MAPPED_TRACES_H_
+#define CMPCOV_MAPPED_TRACES_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include "arena.h"
+#include "common.h"
+
+class MappedTraces {
+ public:
+  // Creates an object saving files in the |directory| directory. No files are
+  // created until traces are appended for a module.
+  explicit MappedTraces(const std::string& directory)
+    : directory_(directory), finalized_(false) { }
+
+  // Checks if the output file for the module has already been created.
+  bool HasModule(int module_index) const {
+    return module_index < files_.size() &&
+           files_[module_index].data != nullptr;
+  }
+
+  // Creates and maps the output file for a module with the specified name.
+  // Kills the process on failure.
+  void AddModule(int module_index, const char *module_name);
+
+  // Appends a trace to the output file of the module, which must have been
+  // added before.
+  void Append(int module_index, size_t trace);
+
+  // Truncates all output files to the size of the data saved in them, and
+  // unmaps them. Any traces appended afterwards are dropped.
+  void Finalize();
+
+  // Unmaps and closes all output files without truncating them, leaving them
+  // to another process sharing them, e.g. the parent of a forked child. Any
+  // traces appended afterwards are dropped.
+  void Detach();
+
+ private:
+  struct MappedFile {
+    char path[MAX_PATH];
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint8_t *data;
+
+    // The current size of the file and the mapping, in bytes.
+    size_t capacity;
+
+    // The number of bytes used so far, including the magic value.
+    size_t size;
+  };
+
+  // Maps the first |capacity| bytes of the file, extending it if necessary.
+  static void MapFile(MappedFile *file, size_t capacity);
+
+  // Unmaps the file, but keeps it open.
+  static void UnmapFile(MappedFile *file);
+
+  // The output directory.
+  std::string directory_;
+
+  // Set once the files are finalized.
+  bool finalized_;
+
+  // Output files indexed by the module index, with a null data pointer for
+  // modules without any traces so far.
+  ArenaVector<MappedFile> files_;
+};
+
+#endif  // CMPCOV_MAPPED_TRACES_H_
@@ -0,0 +1,176 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "module_filter.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+
+// The initial number of ranges in the table.
+static const size_t kInitialCapacity = 16;
+
+// The maximum number of lookups retried because of concurrent updates of the
+// ranges, after which the address is rejected, and the number of them retried
+// right away, before yielding to let a preempted update finish. The updates
+// are short, so the limit is only reached if an update can't make progress,
+// e.g. because it has been interrupted by a signal handler on the checking
+// thread.
+static const int kMaxRetries = 10000;
+static const int kMaxSpins = 100;
+
+// Copies a list of names to the arena.
+static ArenaVector<ArenaString> ToArenaNames(
+    const std::vector<std::string>& names) {
+  ArenaVector<ArenaString> arena_names;
+  for (const std::string& name : names) {
+    arena_names.emplace_back(name.c_str());
+  }
+  return arena_names;
+}
+
+ModuleFilter::ModuleFilter(const std::string& included,
+                           const std::string& excluded)
+  : included_names_(ToArenaNames(SplitList(included))),
+    excluded_names_(ToArenaNames(SplitList(excluded))),
+    has_included_(!included_names_.empty()),
+    sequence_(0),
+    ranges_count_(0) {
+  tables_.emplace_back(ArenaNew<RangeTable>(kInitialCapacity));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+void ModuleFilter::Resolve(const char *module_name, size_t base, size_t size) {
+  const Range range = {
+      base, base + size,
+      (!has_included_ || IsListed(included_names_, module_name)) &&
+          !IsListed(excluded_names_, module_name)};
+
+  // Copy the current ranges, except for the ones overlapping the new module,
+  // which must have been unloaded.
+  RangeTable *table = tables_.back().get();
+  const size_t count = ranges_count_.load(std::memory_order_relaxed);
+  ArenaVector<Range> ranges;
+  ranges.reserve(count + 1);
+  for (size_t i = 0; i < count; i++) {
+    const Range old_range = {
+        (*table)[i].start.load(std::memory_order_relaxed),
+        (*table)[i].end.load(std::memory_order_relaxed),
+        (*table)[i].accepted.load(std::memory_order_relaxed)};
+    if (old_range.end <= range.start || old_range.start >= range.end) {
+      ranges.push_back(old_range);
+    }
+  }
+
+  ranges.insert(
+      std::upper_bound(ranges.begin(), ranges.end(), range,
+                       [](const Range& a, const Range& b) {
+                         return a.start < b.start;
+                       }),
+      range);
+
+  // A full table is replaced by a copy of twice the size, which holds the same
+  // ranges, so it can be published before the update.
+  if (ranges.size() > table->size()) {
+    tables_.emplace_back(ArenaNew<RangeTable>(table->size() * 2));
+    RangeTable *new_table = tables_.back().get();
+    for (size_t i = 0; i < count; i++) {
+      (*new_table)[i].start.store(
+          (*table)[i].start.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      (*new_table)[i].end.store(
+          (*table)[i].end.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      (*new_table)[i].accepted.store(
+          (*table)[i].accepted.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+    table_.store(new_table, std::memory_order_release);
+    table = new_table;
+  }
+
+  // Update the ranges in place, with an odd sequence counter in the meantime.
+  const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (size_t i = 0; i < ranges.size(); i++) {
+    (*table)[i].start.store(ranges[i].start, std::memory_order_relaxed);
+    (*table)[i].end.store(ranges[i].end, std::memory_order_relaxed);
+    (*table)[i].accepted.store(ranges[i].accepted, std::memory_order_relaxed);
+  }
+  ranges_count_.store(ranges.size(), std::memory_order_relaxed);
+
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+ModuleFilter::Verdict ModuleFilter::Check(size_t pc) const {
+  for (int i = 0; i < kMaxRetries; i++) {
+    if (i >= kMaxSpins) {
+      std::this_thread::yield();
+    }
+
+    const uint32_t sequence = sequence_.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+
+    // The number of ranges may belong to a larger table published in the
+    // meantime, in which case the lookup is retried anyway.
+    const RangeTable *table = table_.load(std::memory_order_acquire);
+    const size_t count =
+        std::min(ranges_count_.load(std::memory_order_relaxed), table->size());
+    const Verdict verdict = Lookup(*table, count, pc);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_.load(std::memory_order_relaxed) == sequence) {
+      return verdict;
+    }
+  }
+  return Verdict::kRejected;
+}
+
+ModuleFilter::Verdict ModuleFilter::Lookup(const RangeTable& table,
+                                           size_t count, size_t pc) {
+  // Find the first range starting after the address, the preceding one is the
+  // only candidate which may contain it.
+  auto it = std::upper_bound(
+      table.begin(), table.begin() + count, pc,
+      [](size_t addr, const SharedRange& range) {
+        return addr < range.start.load(std::memory_order_relaxed);
+      });
+  if (it == table.begin() ||
+      pc >= (--it)->end.load(std::memory_order_relaxed)) {
+    return Verdict::kUnknownModule;
+  }
+  return it->accepted.load(std::memory_order_relaxed) ? Verdict::kAccepted
+                                                      : Verdict::kRejected;
+}
+
+bool ModuleFilter::IsListed(const ArenaVector<ArenaString>& names,
+                            const char *module_name) {
+  for (const ArenaString& name : names) {
+    if (name == module_name) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,115 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A filter of the modules in which comparisons are traced, configured with
+// comma-separated lists of module names (i.e. file names of the executable
+// images, as used in the names of the .sancov files) to include or exclude.
+// The names are translated into the address ranges of the modules as they are
+// registered (see Resolve), so that a callback can be checked with a binary
+// search, before looking up its module or taking any locks. The addresses
+// outside of any resolved module are reported as such, so that the modules
+// loaded later in the process can be resolved on first use.
+//
+// The ranges are updated in place, under a sequence counter which the checks
+// read before and after the lookup, retrying if it has changed in between.
+// Only a full table is replaced, by one of twice the size, so the memory used
+// by the filter is bounded by twice the largest number of modules loaded at
+// once, irrespective of how many times they are loaded and unloaded.
+
+#ifndef CMPCOV_MODULE_FILTER_H_
+#define CMPCOV_MODULE_FILTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "arena.h"
+
+class ModuleFilter {
+ public:
+  // Creates a filter accepting only the modules listed in |included| (or all
+  // modules if it's empty), except for the ones listed in |excluded|.
+  ModuleFilter(const std::string& included, const std::string& excluded);
+
+  // Adds the address range of a module with the specified name to the filter,
+  // replacing the ranges of any unloaded modules it overlaps. May be called
+  // concurrently with Check, but not with itself.
+  void Resolve(const char *module_name, size_t base, size_t size);
+
+  enum class Verdict { kAccepted, kRejected, kUnknownModule };
+
+  // Checks if comparisons at address |pc| should be traced. Returns
+  // kUnknownModule if the address doesn't belong to any resolved module, and
+  // kRejected if the ranges are being updated for too long, e.g. by an
+  // interrupted Resolve on the same thread.
+  Verdict Check(size_t pc) const;
+
+  // Returns the verdict for the addresses which remain outside of any module
+  // once all modules have been resolved.
+  Verdict GetDefaultVerdict() const {
+    return has_included_ ? Verdict::kRejected : Verdict::kAccepted;
+  }
+
+ private:
+  struct Range {
+    size_t start;
+    size_t end;
+    bool accepted;
+  };
+
+  // The ranges as stored in the table, read concurrently with their updates.
+  struct SharedRange {
+    std::atomic<size_t> start;
+    std::atomic<size_t> end;
+    std::atomic<bool> accepted;
+  };
+
+  typedef ArenaVector<SharedRange> RangeTable;
+
+  // Looks up the address in the first |count| ranges of the table.
+  static Verdict Lookup(const RangeTable& table, size_t count, size_t pc);
+
+  static bool IsListed(const ArenaVector<ArenaString>& names,
+                       const char *module_name);
+
+  // The modules are resolved from the callbacks, so all of the lists are kept
+  // in the arena.
+  ArenaVector<ArenaString> included_names_;
+  ArenaVector<ArenaString> excluded_names_;
+
+  // Set if the list of included modules is non-empty, even if none of them
+  // has been resolved, in which case all comparisons are rejected.
+  bool has_included_;
+
+  // The ranges of all resolved modules sorted by the start address, in the
+  // first ranges_count_ entries of the current table. The sequence counter is
+  // odd while they are being updated. The smaller tables replaced by the
+  // current one are kept in tables_, as they may still be in use by
+  // concurrent checks.
+  std::atomic<uint32_t> sequence_;
+  std::atomic<const RangeTable *> table_;
+  std::atomic<size_t> ranges_count_;
+  ArenaVector<std::unique_ptr<RangeTable, ArenaDeleter<RangeTable>>> tables_;
+};
+
+#endif  // CMPCOV_MODULE_FILTER_H_
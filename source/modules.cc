@@ -24,39 +24,248 @@
 #include <windows.h>
 #include <psapi.h>
 #elif __linux__
+#include <fcntl.h>
+#include <link.h>
 #include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <climits>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
-#include <unordered_map>
+#include <utility>
 
 #include "common.h"
+#include "stats.h"
+
+#ifdef __linux__
+namespace {
+
+// An object reported by the dynamic loader.
+struct LoadedObject {
+  size_t start;
+  size_t end;
+  ArenaString path;
+};
+
+// Returns a value which changes every time an object is loaded or unloaded by
+// the dynamic loader. If the loader doesn't provide the dlpi_adds/dlpi_subs
+// counters, the number of loaded objects is used instead.
+int ReadLoaderGeneration(struct dl_phdr_info *info, size_t size, void *data) {
+  uint64_t *generation = static_cast<uint64_t *>(data);
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs) +
+              sizeof(info->dlpi_subs)) {
+    *generation = (static_cast<uint64_t>(info->dlpi_adds) << 32) ^
+                  info->dlpi_subs;
+    return 1;
+  }
 
-int Modules::GetModuleIndex(size_t address) {
-  // Check the previously returned index first as an optimization.
-  if (last_idx_ != -1 &&
-      address >= modules_[last_idx_].base &&
-      address < modules_[last_idx_].base + modules_[last_idx_].size) {
-    return last_idx_;
+  (*generation)++;
+  return 0;
+}
+
+// Saves the address range spanned by the PT_LOAD segments of an object.
+int CollectLoadedObject(struct dl_phdr_info *info, size_t size, void *data) {
+  static const size_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+  size_t start = SIZE_MAX, end = 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+      continue;
+    }
+
+    start = std::min(start,
+                     (info->dlpi_addr + phdr->p_vaddr) & ~page_mask);
+    end = std::max(end, info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz);
   }
 
-  // Because we don't expect that the traced process will consist of many
-  // instrumented modules which will be jumping between themselves, we perform
-  // a slow but simple O(n) search here.
-  for (int i = 0; i < modules_.size(); i++) {
-    if (address >= modules_[i].base &&
-        address < modules_[i].base + modules_[i].size) {
-      last_idx_ = i;
-      return i;
+  if (start >= end) {
+    return 0;
+  }
+
+  LoadedObject object;
+  object.start = start;
+  object.end = end;
+
+  // The main executable is reported with an empty name. Other objects are
+  // reported under the path they were loaded from, which is resolved to keep
+  // the names consistent with the ones found in the memory map.
+  if (info->dlpi_name != nullptr && info->dlpi_name[0] != '\0') {
+    char path[PATH_MAX];
+    if (realpath(info->dlpi_name, path) != nullptr) {
+      object.path = path;
+    } else {
+      object.path = info->dlpi_name;
+    }
+  } else {
+    char path[MAX_PATH + 1];
+    ssize_t length = readlink("/proc/self/exe", path, MAX_PATH);
+    if (length > 0) {
+      object.path.assign(path, length);
+    } else {
+      object.path = "unknown_main";
     }
   }
 
+  static_cast<ArenaVector<LoadedObject> *>(data)->push_back(object);
+  return 0;
+}
+
+// Hashes the module paths found in the memory map.
+struct PathHash {
+  size_t operator()(const ArenaString& path) const {
+    return HashString(path.c_str());
+  }
+};
+
+}  // namespace
+#endif  // __linux__
+
+#ifdef _WIN32
+namespace {
+
+// The definitions of the undocumented LdrRegisterDllNotification interface of
+// ntdll.dll, which are not included in the SDK headers.
+struct LdrUnicodeString {
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+};
+
+// The layout is the same for the load and unload notifications.
+struct LdrDllNotificationData {
+  ULONG Flags;
+  const LdrUnicodeString *FullDllName;
+  const LdrUnicodeString *BaseDllName;
+  PVOID DllBase;
+  ULONG SizeOfImage;
+};
+
+const ULONG kLdrDllNotificationReasonLoaded = 1;
+const ULONG kLdrDllNotificationReasonUnloaded = 2;
+
+typedef VOID (CALLBACK *LdrDllNotificationFunction)(ULONG, const void *, PVOID);
+typedef LONG (NTAPI *LdrRegisterDllNotificationFunction)(
+    ULONG, LdrDllNotificationFunction, PVOID, PVOID *);
+
+}  // namespace
+#endif  // _WIN32
+
+Modules::Modules()
+  : last_range_{0, 0, -1}, loader_generation_(UINT64_MAX) {
+#ifdef _WIN32
+  has_pending_events_ = false;
+
+  // Register for the notifications before the already loaded modules are
+  // enumerated below, so that none of the modules loaded in between are
+  // missed. Modules reported twice are only registered once.
+  LdrRegisterDllNotificationFunction register_notification =
+      reinterpret_cast<LdrRegisterDllNotificationFunction>(GetProcAddress(
+          GetModuleHandleA("ntdll.dll"), "LdrRegisterDllNotification"));
+  if (register_notification != NULL) {
+    PVOID cookie;
+    register_notification(
+        0, reinterpret_cast<LdrDllNotificationFunction>(OnLoaderNotification),
+        this, &cookie);
+  }
+
+  // The notifications only cover the modules loaded from now on, so the list
+  // has to start with all modules which are already in memory.
+  Preload();
+#endif
+}
+
+int Modules::GetModuleIndex(size_t address) {
+#ifdef _WIN32
+  // Modules may have been loaded or unloaded since the last lookup, so make
+  // sure that the ranges are up to date before using any of them.
+  if (has_pending_events_.load(std::memory_order_acquire)) {
+    ApplyLoaderEvents();
+  }
+#endif
+
+  // Check the previously returned range first as an optimization.
+  if (address >= last_range_.start && address < last_range_.end) {
+    return last_range_.idx;
+  }
+  CountStat(kStatModuleCacheMisses);
+
+  const int idx = FindModuleRange(address);
+  if (idx != -1) {
+    return idx;
+  }
+
   // If the address is not found in the cache, we have to update it with the new
   // module.
+  CountStat(kStatModuleUpdates);
   return GetModuleIndexAndUpdateCache(address);
 }
 
+int Modules::FindModuleRange(size_t address) {
+  // Find the first range starting after the address, the preceding one is the
+  // only candidate which may contain it.
+  auto it = std::upper_bound(
+      ranges_.begin(), ranges_.end(), address,
+      [](size_t addr, const ModuleRange& range) {
+        return addr < range.start;
+      });
+  if (it == ranges_.begin()) {
+    return -1;
+  }
+
+  --it;
+  if (address >= it->end) {
+    return -1;
+  }
+
+  last_range_ = *it;
+  return it->idx;
+}
+
+int Modules::AddModule(size_t base, size_t size, const char *name) {
+  // Extract the filename from the path.
+  ArenaString filename = name;
+  const size_t separator = filename.find_last_of("/\\");
+  if (separator != ArenaString::npos) {
+    filename = filename.substr(separator + 1);
+  }
+
+  // Reuse the index of the module if it has been seen before, e.g. if the list
+  // of modules is being rebuilt.
+  int idx = -1;
+  for (int i = 0; i < modules_.size(); i++) {
+    if (modules_[i].base == base && modules_[i].name == filename) {
+      idx = i;
+      modules_[i].size = std::max(modules_[i].size, size);
+      break;
+    }
+  }
+
+  if (idx == -1) {
+    ModuleInfo new_module;
+    new_module.base = base;
+    new_module.size = size;
+    new_module.name = filename;
+    new_module.id = HashString(filename.c_str());
+
+    modules_.push_back(new_module);
+    idx = modules_.size() - 1;
+  }
+
+  // Insert the range in the sorted list.
+  ModuleRange range = {base, base + size, idx};
+  auto it = std::upper_bound(
+      ranges_.begin(), ranges_.end(), range,
+      [](const ModuleRange& a, const ModuleRange& b) {
+        return a.start < b.start;
+      });
+  ranges_.insert(it, range);
+
+  return idx;
+}
+
 int Modules::GetModulesCount() const {
   return modules_.size();
 }
@@ -65,10 +274,18 @@ size_t Modules::GetModuleBaseAddress(int idx) const {
   return modules_[idx].base;
 }
 
-std::string Modules::GetModuleName(int idx) const {
+size_t Modules::GetModuleSize(int idx) const {
+  return modules_[idx].size;
+}
+
+const ArenaString& Modules::GetModuleName(int idx) const {
   return modules_[idx].name;
 }
 
+uint64_t Modules::GetModuleId(int idx) const {
+  return modules_[idx].id;
+}
+
 int Modules::GetModuleIndexAndUpdateCache(size_t address) {
 #ifdef _WIN32
   // Translate an instruction address to the base address of the executable
@@ -94,39 +311,172 @@ int Modules::GetModuleIndexAndUpdateCache(size_t address) {
     return -1;
   }
 
-  // Skip to the last backslash, which should be followed by the filename.
-  char *filename = strrchr(filepath, '\\');
-  if (filename != NULL) {
-    filename++;
-  } else {
-    filename = filepath;
+  // Add the new module information to cache and return its index.
+  return AddModule((size_t)modinfo.lpBaseOfDll, modinfo.SizeOfImage, filepath);
+
+#elif __linux__
+  // Most addresses belong to objects known to the dynamic loader, so check if
+  // any new objects have been loaded first.
+  if (RefreshLoadedModules()) {
+    const int idx = FindModuleRange(address);
+    if (idx != -1) {
+      return idx;
+    }
   }
 
-  // Add the new module information to cache and return its index.
-  ModuleInfo new_module;
-  new_module.base = (size_t)modinfo.lpBaseOfDll;
-  new_module.size = modinfo.SizeOfImage;
-  new_module.name = filename;
+  return GetModuleIndexFromMemoryMap(address);
+#endif
+}
 
-  modules_.push_back(new_module);
+void Modules::Preload() {
+#ifdef _WIN32
+  HMODULE hmodules[1024];
+  DWORD needed;
+  if (!EnumProcessModules(GetCurrentProcess(), hmodules, sizeof(hmodules),
+                          &needed)) {
+    return;
+  }
 
-  return modules_.size() - 1;
+  const DWORD count = std::min<DWORD>(needed / sizeof(HMODULE), 1024);
+  for (DWORD i = 0; i < count; i++) {
+    MODULEINFO modinfo;
+    char filepath[MAX_PATH];
+    if (!GetModuleInformation(GetCurrentProcess(), hmodules[i], &modinfo,
+                              sizeof(modinfo)) ||
+        GetModuleFileNameA(hmodules[i], filepath, sizeof(filepath)) == 0 ||
+        FindModuleRange((size_t)modinfo.lpBaseOfDll) != -1) {
+      continue;
+    }
 
+    AddModule((size_t)modinfo.lpBaseOfDll, modinfo.SizeOfImage, filepath);
+  }
+  CountStat(kStatModuleUpdates);
 #elif __linux__
+  if (RefreshLoadedModules()) {
+    CountStat(kStatModuleUpdates);
+  }
+#endif
+}
+
+#ifdef _WIN32
+void __stdcall Modules::OnLoaderNotification(unsigned long reason,
+                                             const void *data, void *context) {
+  if (reason != kLdrDllNotificationReasonLoaded &&
+      reason != kLdrDllNotificationReasonUnloaded) {
+    return;
+  }
+
+  const LdrDllNotificationData *notification =
+      static_cast<const LdrDllNotificationData *>(data);
+  Modules *modules = static_cast<Modules *>(context);
+
+  LoaderEvent event;
+  event.loaded = (reason == kLdrDllNotificationReasonLoaded);
+  event.base = reinterpret_cast<size_t>(notification->DllBase);
+  event.size = notification->SizeOfImage;
+
+  if (event.loaded) {
+    // Convert the path to the same form as returned by GetModuleFileNameA.
+    char path[MAX_PATH];
+    const int length = WideCharToMultiByte(
+        CP_ACP, 0, notification->FullDllName->Buffer,
+        notification->FullDllName->Length / sizeof(WCHAR), path,
+        sizeof(path) - 1, NULL, NULL);
+    path[length] = '\0';
+    event.path = path;
+  }
 
-  // Scan through /proc/self/maps in search of the module.
-  FILE *f = fopen("/proc/self/maps", "r");
-  if (f == nullptr) {
+  std::lock_guard<std::mutex> lock(modules->events_mutex_);
+  modules->pending_events_.push_back(std::move(event));
+  modules->has_pending_events_.store(true, std::memory_order_release);
+}
+
+void Modules::ApplyLoaderEvents() {
+  ArenaVector<LoaderEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(events_mutex_);
+    events.swap(pending_events_);
+    has_pending_events_.store(false, std::memory_order_relaxed);
+  }
+
+  for (const LoaderEvent& event : events) {
+    if (!event.loaded) {
+      RemoveModuleRange(event.base);
+    } else if (FindModuleRange(event.base) == -1) {
+      AddModule(event.base, event.size, event.path.c_str());
+    }
+  }
+
+  last_range_ = {0, 0, -1};
+  CountStat(kStatModuleUpdates);
+}
+
+void Modules::RemoveModuleRange(size_t base) {
+  ranges_.erase(
+      std::remove_if(ranges_.begin(), ranges_.end(),
+                     [base](const ModuleRange& range) {
+                       return range.start == base;
+                     }),
+      ranges_.end());
+}
+#endif  // _WIN32
+
+#ifdef __linux__
+bool Modules::RefreshLoadedModules() {
+  uint64_t generation = 0;
+  dl_iterate_phdr(ReadLoaderGeneration, &generation);
+  if (generation == loader_generation_) {
+    return false;
+  }
+  loader_generation_ = generation;
+
+  ArenaVector<LoadedObject> objects;
+  dl_iterate_phdr(CollectLoadedObject, &objects);
+
+  // Rebuild the list of ranges from scratch, dropping the ones of any unloaded
+  // objects.
+  ranges_.clear();
+  last_range_ = {0, 0, -1};
+  for (const auto& object : objects) {
+    AddModule(object.start, object.end - object.start,
+              object.path.c_str());
+  }
+
+  return true;
+}
+
+int Modules::GetModuleIndexFromMemoryMap(size_t address) {
+  // Read /proc/self/maps with plain system calls, as stdio would allocate its
+  // buffer with the global allocator.
+  const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
     Die("Unable to open /proc/self/maps\n");
   }
 
-  std::unordered_map<std::string, uint64_t> base_addresses;
+  ArenaString maps;
+  char chunk[4096];
+  ssize_t bytes_read;
+  while ((bytes_read = read(fd, chunk, sizeof(chunk))) > 0) {
+    maps.append(chunk, bytes_read);
+  }
+  close(fd);
+
+  // Scan through the memory map in search of the module.
+  ArenaUnorderedMap<ArenaString, uint64_t, PathHash> base_addresses;
   char line[512];
-  while (!feof(f)) {
-    if (fgets(line, sizeof(line), f) == nullptr) {
-      break;
+  size_t line_start = 0;
+  while (line_start < maps.size()) {
+    size_t line_end = maps.find('\n', line_start);
+    if (line_end == ArenaString::npos) {
+      line_end = maps.size();
     }
 
+    const size_t line_length =
+        std::min(line_end - line_start, sizeof(line) - 1);
+    memcpy(line, maps.data() + line_start, line_length);
+    line[line_length] = '\0';
+    line_start = line_end + 1;
+
     uint64_t address_start, address_end;
     char pathname[MAX_PATH + 1];
 
@@ -144,8 +494,9 @@ int Modules::GetModuleIndexAndUpdateCache(size_t address) {
 
     // If this is the first time we see this module, save its base address so we
     // can reference it later.
-    if (base_addresses.find(pathname) == base_addresses.end()) {
-      base_addresses[pathname] = address_start;
+    const ArenaString path = pathname;
+    if (base_addresses.find(path) == base_addresses.end()) {
+      base_addresses[path] = address_start;
     }
 
     // Check if the address falls into the region address range.
@@ -159,34 +510,17 @@ int Modules::GetModuleIndexAndUpdateCache(size_t address) {
       snprintf(pathname, sizeof(pathname), "unknown_%" PRIx64, address_start);
     } else {
       // If there is a path name, look up the base address of the module.
-      const auto it = base_addresses.find(pathname);
+      const auto it = base_addresses.find(path);
       if (it != base_addresses.end()) {
         address_start = it->second;
       }
     }
 
-    // Extract the filename from the path.
-    char *filename = strrchr(pathname, '/');
-    if (filename != nullptr) {
-      filename++;
-    } else {
-      filename = pathname;
-    }
-
     // Add the new module information to cache and return its index.
-    ModuleInfo new_module;
-    new_module.base = address_start;
-    new_module.size = address_end - address_start;
-    new_module.name = filename;
-
-    modules_.push_back(new_module);
-
-    fclose(f);
-    return modules_.size() - 1;
+    return AddModule(address_start, address_end - address_start, pathname);
   }
 
-  fclose(f);
   return -1;
-#endif
 }
+#endif  // __linux__
 
@@ -22,24 +22,43 @@
 // The Modules class is designed to keep track of executable images loaded in
 // the address space of the local process, and translate virtual addresses into
 // the base+offset form.
+//
+// On Linux, the list of images is obtained from the dynamic loader with
+// dl_iterate_phdr(), and only refreshed when an address can't be found and the
+// set of loaded objects has changed since the last refresh (i.e. a library has
+// been loaded or unloaded). The /proc/self/maps file is only parsed as a last
+// resort, for code located outside of any object known to the loader.
+//
+// On Windows, the list of images is built up front with EnumProcessModules(),
+// and kept current with the DLL load and unload notifications of the loader
+// (LdrRegisterDllNotification). The notifications are delivered under the
+// loader lock, so they are only queued, and applied by the next lookup.
 
 #ifndef CMPCOV_MODULES_H_
 #define CMPCOV_MODULES_H_
 
+#include <cstdint>
 #include <cstdlib>
-#include <string>
-#include <vector>
+#ifdef _WIN32
+#include <atomic>
+#include <mutex>
+#endif
+
+#include "arena.h"
 
 // A descriptor of an executable module in the process address space.
 struct ModuleInfo {
   size_t base;
   size_t size;
-  std::string name;
+  ArenaString name;
+
+  // A hash of the module name, which identifies the module across processes.
+  uint64_t id;
 };
 
 class Modules {
  public:
-  Modules() : last_idx_(-1) { }
+  Modules();
 
   // Translates an address to a module index recognized by this class.
   int GetModuleIndex(size_t address);
@@ -50,19 +69,91 @@ class Modules {
   // Returns the base address of an image associated with the given index.
   size_t GetModuleBaseAddress(int idx) const;
 
+  // Returns the size of the image associated with the given index.
+  size_t GetModuleSize(int idx) const;
+
   // Returns the name of the image associated with the given index.
-  std::string GetModuleName(int idx) const;
+  const ArenaString& GetModuleName(int idx) const;
+
+  // Returns the hash of the name of the image associated with the given index.
+  uint64_t GetModuleId(int idx) const;
+
+  // Registers all modules currently known to the dynamic loader, so that the
+  // first lookups of their addresses don't have to query the system.
+  void Preload();
 
  private:
-  // A list of modules known by the class.
-  std::vector<ModuleInfo> modules_;
+  // An address range occupied by one of the modules.
+  struct ModuleRange {
+    size_t start;
+    size_t end;
+    int idx;
+  };
+
+  // A list of modules known by the class. The indexes of the modules never
+  // change, even if they are unloaded from memory.
+  ArenaVector<ModuleInfo> modules_;
+
+  // Address ranges of the currently loaded modules, sorted by the start
+  // address and searched with a binary search.
+  ArenaVector<ModuleRange> ranges_;
+
+  // The range last returned by a call to GetModuleIndex, used for optimization.
+  ModuleRange last_range_;
 
-  // The last index returned by a call to GetModuleName, used for optimization.
-  int last_idx_;
+  // The state of the dynamic loader at the time of the last refresh of the
+  // module list.
+  uint64_t loader_generation_;
+
+  // Looks up the address in the sorted list of ranges, and returns the index of
+  // the corresponding module or -1 if it's not found.
+  int FindModuleRange(size_t address);
+
+  // Registers a module range, reusing the module index if a module with the
+  // same name and base address is already known.
+  int AddModule(size_t base, size_t size, const char *name);
 
   // Obtains information about a module corresponding to a specific address from
   // the operating system, and adds it to the internal cache.
   int GetModuleIndexAndUpdateCache(size_t address);
+
+#ifdef _WIN32
+  // A load or unload of a module reported by the loader.
+  struct LoaderEvent {
+    bool loaded;
+    size_t base;
+    size_t size;
+    ArenaString path;
+  };
+
+  // Events reported since the last lookup, guarded by events_mutex_. The mutex
+  // is never held while acquiring any other locks, except for the one of the
+  // arena.
+  std::mutex events_mutex_;
+  ArenaVector<LoaderEvent> pending_events_;
+  std::atomic<bool> has_pending_events_;
+
+  // Receives the notifications of the loader, see LdrRegisterDllNotification.
+  static void __stdcall OnLoaderNotification(unsigned long reason,
+                                             const void *data, void *context);
+
+  // Applies the queued loader events to the list of ranges.
+  void ApplyLoaderEvents();
+
+  // Removes the range of an unloaded module starting at |base|.
+  void RemoveModuleRange(size_t base);
+#endif  // _WIN32
+
+#ifdef __linux__
+  // Rebuilds the list of ranges from the objects reported by the dynamic
+  // loader, if it has changed since the last call. Returns true if the list
+  // was rebuilt.
+  bool RefreshLoadedModules();
+
+  // Searches /proc/self/maps for a region containing the address, which is
+  // used for code not associated with any object known to the loader.
+  int GetModuleIndexFromMemoryMap(size_t address);
+#endif  // __linux__
 };
 
 #endif  // CMPCOV_MODULES_H_
@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "operand_dictionary.h"
+
+#include <cstring>
+
+static const size_t kMaxProbes = 16;
+
+OperandDictionary::OperandDictionary(size_t max_tokens)
+  : max_tokens_(max_tokens), tokens_count_(0), dropped_count_(0) {
+  // Keep the load factor of the table at or below one half.
+  slots_count_ = 1;
+  while (slots_count_ < max_tokens * 2) {
+    slots_count_ *= 2;
+  }
+  slots_.reset(new Slot[slots_count_]());
+}
+
+void OperandDictionary::Add(size_t pc, const void *data, size_t length) {
+  if (length == 0) {
+    return;
+  } else if (length > kMaxTokenLength) {
+    length = kMaxTokenLength;
+  }
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  const uint64_t key = GetKey(pc, bytes, length);
+  const size_t index = key & (slots_count_ - 1);
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    Slot *slot = &slots_[(index + i) & (slots_count_ - 1)];
+
+    uint64_t slot_key = slot->key.load(std::memory_order_relaxed);
+    if (slot_key == key) {
+      return;
+    } else if (slot_key != 0) {
+      continue;
+    }
+
+    if (!slot->key.compare_exchange_strong(slot_key, key,
+                                           std::memory_order_relaxed)) {
+      // Another thread has just claimed the slot, possibly for the same token.
+      if (slot_key == key) {
+        return;
+      }
+      continue;
+    }
+
+    // The slot is claimed either way, so that the token is only counted once.
+    if (tokens_count_.fetch_add(1, std::memory_order_relaxed) >= max_tokens_) {
+      break;
+    }
+
+    slot->pc = pc;
+    memcpy(slot->data, bytes, length);
+    slot->length.store(static_cast<uint8_t>(length), std::memory_order_release);
+    return;
+  }
+
+  dropped_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<std::pair<size_t, std::string>> OperandDictionary::GetTokens()
+    const {
+  std::vector<std::pair<size_t, std::string>> tokens;
+  for (size_t i = 0; i < slots_count_; i++) {
+    const uint8_t length = slots_[i].length.load(std::memory_order_acquire);
+    if (length != 0) {
+      tokens.emplace_back(
+          slots_[i].pc,
+          std::string(reinterpret_cast<const char *>(slots_[i].data), length));
+    }
+  }
+  return tokens;
+}
+
+uint64_t OperandDictionary::GetKey(size_t pc, const uint8_t *data,
+                                   size_t length) {
+  // The 64-bit FNV-1a hash of the token, seeded with the site address.
+  uint64_t hash = 0xCBF29CE484222325ULL ^
+                  (static_cast<uint64_t>(pc) * 0x9E3779B97F4A7C15ULL);
+  for (size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ULL;
+  }
+  hash ^= hash >> 32;
+  return (hash != 0) ? hash : 1;
+}
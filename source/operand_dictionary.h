@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A dictionary of the operands of comparisons with constants, i.e. the values
+// that the program expects to find in its input, which a fuzzer can insert
+// into the inputs directly instead of discovering them byte by byte. Every
+// distinct (site, token) pair is stored once, in a fixed-size open-addressing
+// table updated concurrently without locking. The number of tokens is bounded,
+// and the tokens which don't fit once the limit is reached are only counted.
+
+#ifndef CMPCOV_OPERAND_DICTIONARY_H_
+#define CMPCOV_OPERAND_DICTIONARY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The maximum length of a token, longer operands are truncated.
+const size_t kMaxTokenLength = 64;
+
+class OperandDictionary {
+ public:
+  // Creates a dictionary holding up to |max_tokens| tokens.
+  explicit OperandDictionary(size_t max_tokens);
+
+  // Records |length| bytes of |data| as a token found at the site at address
+  // |pc|, unless it has already been recorded there.
+  void Add(size_t pc, const void *data, size_t length);
+
+  // Returns the (site address, token) pairs recorded so far.
+  std::vector<std::pair<size_t, std::string>> GetTokens() const;
+
+  // Returns the number of tokens which didn't fit in the dictionary. The
+  // dropped tokens still claim empty slots of the table, so that each of them
+  // is counted once, until the table fills up at twice the maximum number of
+  // tokens; from then on, they are counted at every attempt.
+  uint64_t GetDroppedCount() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    // The hash of the site and the token, or zero for an empty slot.
+    std::atomic<uint64_t> key;
+
+    // The length of the token, set once the token is written to the slot, or
+    // zero if it hasn't been written (yet).
+    std::atomic<uint8_t> length;
+
+    size_t pc;
+    uint8_t data[kMaxTokenLength];
+  };
+
+  // Returns the hash identifying the token at the site, which is never zero.
+  static uint64_t GetKey(size_t pc, const uint8_t *data, size_t length);
+
+  const size_t max_tokens_;
+  size_t slots_count_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> tokens_count_;
+  std::atomic<uint64_t> dropped_count_;
+};
+
+#endif  // CMPCOV_OPERAND_DICTIONARY_H_
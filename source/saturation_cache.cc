@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "saturation_cache.h"
+
+// The layout of a cache entry is as follows:
+//
+// Bits 16-63: Tag, i.e. the upper 32 bits of the site address, followed by the
+//             16 bits of the site arguments.
+// Bits 10-15: The maximum depth recorded for the site.
+// Bits  0-9 : The generation in which the entry was written.
+//
+// The lower 16 bits of the site address are not stored, as they can be derived
+// from the entry index and the site arguments.
+static const int kIndexBits = 16;
+static const int kDepthBits = 6;
+static const int kGenerationBits = 10;
+
+static const size_t kEntriesCount = 1 << kIndexBits;
+static const uint64_t kAddressMask = (1ULL << 48) - 1;
+static const int kMaxDepth = (1 << kDepthBits) - 1;
+static const uint32_t kMaxGeneration = (1 << kGenerationBits) - 1;
+
+SaturationCache::SaturationCache()
+  : entries_(new std::atomic<uint64_t>[kEntriesCount]()), generation_(1) {
+}
+
+bool SaturationCache::IsSaturated(uint64_t site, int depth) const {
+  const uint64_t entry =
+      entries_[GetIndex(site)].load(std::memory_order_relaxed);
+
+  return (entry >> (kDepthBits + kGenerationBits)) == GetTag(site) &&
+         (entry & kMaxGeneration) ==
+             generation_.load(std::memory_order_relaxed) &&
+         ((entry >> kGenerationBits) & kMaxDepth) >=
+             static_cast<uint64_t>(depth);
+}
+
+void SaturationCache::Update(uint64_t site, int depth) {
+  if (depth > kMaxDepth) {
+    depth = kMaxDepth;
+  }
+
+  // Make sure we don't overwrite a higher depth stored for the same site. A
+  // concurrent update may still be lost, which is harmless.
+  if (IsSaturated(site, depth)) {
+    return;
+  }
+
+  const uint64_t entry =
+      (GetTag(site) << (kDepthBits + kGenerationBits)) |
+      (static_cast<uint64_t>(depth) << kGenerationBits) |
+      generation_.load(std::memory_order_relaxed);
+  entries_[GetIndex(site)].store(entry, std::memory_order_relaxed);
+}
+
+void SaturationCache::Reset() {
+  uint32_t generation = generation_.load(std::memory_order_relaxed) + 1;
+
+  // Once the generation counter wraps around, entries from old generations
+  // would become valid again, so the cache has to be cleared for real. This
+  // only happens once every kMaxGeneration resets.
+  if (generation > kMaxGeneration) {
+    for (size_t i = 0; i < kEntriesCount; i++) {
+      entries_[i].store(0, std::memory_order_relaxed);
+    }
+    generation = 1;
+  }
+
+  generation_.store(generation, std::memory_order_relaxed);
+}
+
+size_t SaturationCache::GetIndex(uint64_t site) {
+  const uint64_t address = site & kAddressMask;
+  const uint64_t args = site >> 48;
+  return (address ^ (args * 0x9E37)) & (kEntriesCount - 1);
+}
+
+uint64_t SaturationCache::GetTag(uint64_t site) {
+  const uint64_t address = site & kAddressMask;
+  const uint64_t args = site >> 48;
+  return (address >> kIndexBits) | (args << (48 - kIndexBits));
+}
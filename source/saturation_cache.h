@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A compact, direct-mapped cache of the maximum number of matching bytes
+// recorded so far at every comparison site. Since a comparison with N matching
+// bytes produces the traces for depths 1..N, a comparison which doesn't exceed
+// the cached depth can't produce any new traces, and can be skipped before
+// taking any locks or performing any hash table lookups.
+//
+// The cache may be accessed concurrently without locking. Every entry is a
+// single 64-bit word holding the complete site identifier, the depth, and the
+// generation in which it was written, so a lookup never mistakes one site for
+// another. Entries may be evicted by colliding sites, in which case the evicted
+// site simply takes the slow path again.
+
+#ifndef CMPCOV_SATURATION_CACHE_H_
+#define CMPCOV_SATURATION_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+class SaturationCache {
+ public:
+  SaturationCache();
+
+  // Returns true if at least |depth| matching bytes have already been recorded
+  // for the site. The site is identified by a wide trace (see
+  // Traces::ConstructWideTrace) with arguments describing the comparison.
+  bool IsSaturated(uint64_t site, int depth) const;
+
+  // Marks |depth| matching bytes as recorded for the site.
+  void Update(uint64_t site, int depth);
+
+  // Invalidates all entries in the cache.
+  void Reset();
+
+ private:
+  // Returns the index of the entry assigned to the site, and the tag which
+  // identifies the site, together with the index.
+  static size_t GetIndex(uint64_t site);
+  static uint64_t GetTag(uint64_t site);
+
+  std::unique_ptr<std::atomic<uint64_t>[]> entries_;
+
+  // The current generation of the cache. Entries written in older generations
+  // are treated as empty.
+  std::atomic<uint32_t> generation_;
+};
+
+#endif  // CMPCOV_SATURATION_CACHE_H_
@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "shared_traces.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __linux__
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+#include "common.h"
+
+void *AttachSharedRegion(const char *id, size_t *region_size) {
+  void *region;
+
+#ifdef _WIN32
+  HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, id);
+  if (mapping == NULL) {
+    Die("Unable to open the \"%s\" file mapping.\n", id);
+  }
+
+  region = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (region == NULL) {
+    Die("Unable to map the \"%s\" file mapping.\n", id);
+  }
+
+  MEMORY_BASIC_INFORMATION mbi;
+  if (VirtualQuery(region, &mbi, sizeof(mbi)) == 0) {
+    Die("Unable to query the size of the \"%s\" file mapping.\n", id);
+  }
+  *region_size = mbi.RegionSize;
+#elif __linux__
+  const int shm_id = atoi(id);
+
+  struct shmid_ds shm_info;
+  if (shmctl(shm_id, IPC_STAT, &shm_info) != 0) {
+    Die("Unable to query the shared memory segment %d.\n", shm_id);
+  }
+  *region_size = shm_info.shm_segsz;
+
+  region = shmat(shm_id, nullptr, 0);
+  if (region == reinterpret_cast<void *>(-1)) {
+    Die("Unable to attach to the shared memory segment %d.\n", shm_id);
+  }
+#endif
+
+  return region;
+}
+
+SharedTraces::SharedTraces(const char *id) {
+  size_t region_size;
+  void *region = AttachSharedRegion(id, &region_size);
+  if (region_size < sizeof(SharedTracesHeader)) {
+    Die("The shared memory region \"%s\" is too small (%zu bytes).\n",
+        id, region_size);
+  }
+
+  header_ = static_cast<SharedTracesHeader *>(region);
+  entries_ = reinterpret_cast<SharedTraceEntry *>(header_ + 1);
+
+  header_->magic = kSharedMagic;
+  header_->capacity =
+      (region_size - sizeof(SharedTracesHeader)) / sizeof(SharedTraceEntry);
+}
+
+void SharedTraces::Append(uint64_t module_id, size_t trace) {
+  const uint64_t idx = header_->count.fetch_add(1, std::memory_order_relaxed);
+  if (idx >= header_->capacity) {
+    // Undo the increment, so that the count never exceeds the capacity from
+    // the point of view of the fuzzer.
+    header_->count.fetch_sub(1, std::memory_order_relaxed);
+    header_->overflow.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  entries_[idx].module_id = module_id;
+  entries_[idx].trace = trace;
+}
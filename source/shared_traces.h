@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// An output channel which appends new traces to a shared memory region created
+// by the fuzzer, as an alternative to writing .sancov files at process exit.
+//
+// The region is identified by a SysV shared memory ID on Linux, or by the name
+// of a file mapping object on Windows. It starts with a SharedTracesHeader
+// structure, followed by as many SharedTraceEntry structures as fit in the rest
+// of the region. cmpcov initializes the magic and capacity fields when it
+// attaches to the region, and then atomically increments the count field for
+// every new trace. The fuzzer is expected to clear the count before each
+// execution of the target. Traces which don't fit in the region are dropped,
+// and accounted for in the overflow field.
+
+#ifndef CMPCOV_SHARED_TRACES_H_
+#define CMPCOV_SHARED_TRACES_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+struct SharedTracesHeader {
+  // kSharedMagic64 or kSharedMagic32, depending on the bitness of the traces.
+  uint64_t magic;
+
+  // The number of entries which fit in the region.
+  uint64_t capacity;
+
+  // The number of entries written to the region so far.
+  std::atomic<uint64_t> count;
+
+  // The number of entries which didn't fit in the region.
+  std::atomic<uint64_t> overflow;
+};
+
+struct SharedTraceEntry {
+  // A 64-bit FNV-1a hash of the module name, as it would appear in the name of
+  // the .sancov file (e.g. "test" for cmp.test.1234.sancov).
+  uint64_t module_id;
+
+  // The trace, in the same form as it would be saved in the .sancov file.
+  uint64_t trace;
+};
+
+// Attaches to the shared memory region identified by |id|, i.e. a SysV shared
+// memory ID on Linux or the name of a file mapping object on Windows, and saves
+// its size in |region_size|. Kills the process on failure.
+void *AttachSharedRegion(const char *id, size_t *region_size);
+
+class SharedTraces {
+ public:
+  // Attaches to the shared memory region identified by |id|. Kills the process
+  // if the region doesn't exist or is too small to hold the header.
+  explicit SharedTraces(const char *id);
+
+  // Appends a new trace to the region.
+  void Append(uint64_t module_id, size_t trace);
+
+ private:
+  SharedTracesHeader *header_;
+  SharedTraceEntry *entries_;
+};
+
+#endif  // CMPCOV_SHARED_TRACES_H_
@@ -0,0 +1,110 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "site_denylist.h"
+
+#include <inttypes.h>
+
+#include <cstdio>
+
+#include "common.h"
+
+SiteDenylist::SiteDenylist()
+  : slots_(new std::atomic<size_t>[2]()), slots_mask_(1), hash_shift_(63),
+    size_(0) {
+}
+
+void SiteDenylist::Load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    Die("[-] Unable to open the \"%s\" denylist file.\n", path);
+  }
+
+  char line[MAX_PATH + 64];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    char module_name[MAX_PATH + 1];
+    uint64_t offset;
+
+    const int elems = sscanf(line, "%" TOSTRING(MAX_PATH) "s %" SCNx64,
+                             module_name, &offset);
+    if (elems <= 0 || module_name[0] == '#') {
+      continue;
+    } else if (elems != 2) {
+      Die("[-] Invalid line in the \"%s\" denylist file: %s\n", path, line);
+    }
+
+    sites_.push_back({module_name, offset});
+  }
+  fclose(f);
+
+  // Allocate enough slots for every site to be resolved in a single module
+  // instance, while keeping the table at most half full.
+  size_t slots_count = 2;
+  hash_shift_ = 63;
+  while (slots_count < sites_.size() * 2) {
+    slots_count *= 2;
+    hash_shift_--;
+  }
+
+  slots_.reset(new std::atomic<size_t>[slots_count]());
+  slots_mask_ = slots_count - 1;
+  size_ = 0;
+}
+
+void SiteDenylist::Resolve(const char *module_name, size_t base) {
+  for (const Site& site : sites_) {
+    if (site.module_name != module_name) {
+      continue;
+    }
+
+    // A module loaded multiple times could fill the table, so its further
+    // instances are ignored.
+    if ((size_ + 1) * 2 > slots_mask_ + 1) {
+      return;
+    }
+
+    const size_t pc = base + site.offset;
+    size_t idx = GetIndex(pc);
+    size_t slot;
+    while ((slot = slots_[idx].load(std::memory_order_relaxed)) != 0 &&
+           slot != pc) {
+      idx = (idx + 1) & slots_mask_;
+    }
+
+    if (slot == 0) {
+      slots_[idx].store(pc, std::memory_order_relaxed);
+      size_++;
+    }
+  }
+}
+
+bool SiteDenylist::Contains(size_t pc) const {
+  size_t slot;
+  for (size_t idx = GetIndex(pc);
+       (slot = slots_[idx].load(std::memory_order_relaxed)) != 0;
+       idx = (idx + 1) & slots_mask_) {
+    if (slot == pc) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t SiteDenylist::GetIndex(size_t pc) const {
+  return (static_cast<uint64_t>(pc) * 0x9E3779B97F4A7C15ULL) >> hash_shift_;
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A list of comparison sites which shouldn't be instrumented, e.g. the hottest
+// sites found with a profiling run (see CMPCOV_PROFILE) which haven't produced
+// any useful coverage. The sites are loaded from a text file with one site per
+// line, identified by the name of the module and the hexadecimal offset of the
+// site within it, with any further fields on the line ignored:
+//
+//   libexample.so 0x1a2b3c
+//   # A comment.
+//
+// The offsets are translated into addresses once the base addresses of the
+// modules are known (see Resolve), and the addresses are stored in a compact
+// hash set which can be looked up concurrently without locking, also while new
+// modules are being resolved.
+
+#ifndef CMPCOV_SITE_DENYLIST_H_
+#define CMPCOV_SITE_DENYLIST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SiteDenylist {
+ public:
+  SiteDenylist();
+
+  // Loads the sites from the file at |path|. Kills the process on failure.
+  void Load(const char *path);
+
+  // Adds the addresses of the sites located in a module with the specified
+  // name and base address to the set. May be called concurrently with
+  // Contains, but not with itself.
+  void Resolve(const char *module_name, size_t base);
+
+  // Checks if the site at address |pc| is on the list.
+  bool Contains(size_t pc) const;
+
+  // Returns the number of resolved sites in the set.
+  size_t size() const { return size_; }
+
+  // Returns the number of sites loaded from the file, resolved or not.
+  size_t GetSitesCount() const { return sites_.size(); }
+
+ private:
+  struct Site {
+    std::string module_name;
+    uint64_t offset;
+  };
+
+  // Returns the index of the first slot probed for the address.
+  size_t GetIndex(size_t pc) const;
+
+  // The sites loaded from the file.
+  std::vector<Site> sites_;
+
+  // The resolved addresses, in an open-addressing table with a power-of-two
+  // number of slots, at most half of which are used. Empty slots are zero.
+  std::unique_ptr<std::atomic<size_t>[]> slots_;
+  size_t slots_mask_;
+  int hash_shift_;
+  size_t size_;
+};
+
+#endif  // CMPCOV_SITE_DENYLIST_H_
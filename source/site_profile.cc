@@ -0,0 +1,75 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "site_profile.h"
+
+#include <algorithm>
+
+static const int kIndexBits = 16;
+static const size_t kSlotsCount = 1 << kIndexBits;
+static const size_t kMaxProbes = 16;
+
+SiteProfile::SiteProfile()
+  : slots_(new Slot[kSlotsCount]()), dropped_count_(0) {
+}
+
+void SiteProfile::Count(size_t pc) {
+  const size_t index = GetIndex(pc);
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    Slot *slot = &slots_[(index + i) & (kSlotsCount - 1)];
+
+    size_t slot_pc = slot->pc.load(std::memory_order_relaxed);
+    if (slot_pc == 0 &&
+        slot->pc.compare_exchange_strong(slot_pc, pc,
+                                         std::memory_order_relaxed)) {
+      slot_pc = pc;
+    }
+
+    if (slot_pc == pc) {
+      slot->count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  dropped_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<std::pair<size_t, uint64_t>> SiteProfile::GetTopSites(
+    size_t count) const {
+  std::vector<std::pair<size_t, uint64_t>> sites;
+  for (size_t i = 0; i < kSlotsCount; i++) {
+    const size_t pc = slots_[i].pc.load(std::memory_order_relaxed);
+    if (pc != 0) {
+      sites.emplace_back(pc, slots_[i].count.load(std::memory_order_relaxed));
+    }
+  }
+
+  count = std::min(count, sites.size());
+  std::partial_sort(sites.begin(), sites.begin() + count, sites.end(),
+                    [](const std::pair<size_t, uint64_t>& a,
+                       const std::pair<size_t, uint64_t>& b) {
+                      return a.second > b.second;
+                    });
+  sites.resize(count);
+  return sites;
+}
+
+size_t SiteProfile::GetIndex(size_t pc) {
+  return (static_cast<uint64_t>(pc) * 0x9E3779B97F4A7C15ULL) >>
+         (64 - kIndexBits);
+}
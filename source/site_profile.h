@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A histogram of the executions of comparison sites, used to find the sites
+// which contribute the most to the overhead of the instrumentation. The counts
+// are kept in a fixed-size, open-addressing table of site addresses, updated
+// concurrently without locking. Sites which don't fit in the table once it is
+// full are only counted in aggregate, so the memory usage stays bounded
+// regardless of the number of sites.
+
+#ifndef CMPCOV_SITE_PROFILE_H_
+#define CMPCOV_SITE_PROFILE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class SiteProfile {
+ public:
+  SiteProfile();
+
+  // Counts a single execution of the site at address |pc|.
+  void Count(size_t pc);
+
+  // Returns up to |count| (address, executions) pairs of the most frequently
+  // executed sites, in the descending order of executions.
+  std::vector<std::pair<size_t, uint64_t>> GetTopSites(size_t count) const;
+
+  // Returns the total number of executions of sites which didn't fit in the
+  // table.
+  uint64_t GetDroppedCount() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> pc;
+    std::atomic<uint64_t> count;
+  };
+
+  // Returns the index of the first slot probed for the site.
+  static size_t GetIndex(size_t pc);
+
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> dropped_count_;
+};
+
+#endif  // CMPCOV_SITE_PROFILE_H_
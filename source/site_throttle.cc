@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "site_throttle.h"
+
+#include <algorithm>
+
+// The layout of a table entry is as follows:
+//
+// Bits 48-63: Tag, part 1: The lower 16 bits of the generation.
+// Bits 24-47: Tag, part 2: The lower 24 bits of the site address above the
+//             index bits.
+// Bits 16-23: The number of consecutive evaluations without progress.
+// Bits  0-15: The number of executions left to skip.
+static const int kIndexBits = 12;
+static const int kStreakBits = 8;
+static const int kSkipBits = 16;
+static const int kTagAddressBits = 24;
+
+static const size_t kEntriesCount = 1 << kIndexBits;
+static const uint32_t kMaxStreak = (1 << kStreakBits) - 1;
+static const uint32_t kMaxSkip = (1 << kSkipBits) - 1;
+static const uint64_t kSkipMask = kMaxSkip;
+
+static_assert(SiteThrottle::kMaxThreshold + kSkipBits <= kMaxStreak,
+              "The streak counter is too narrow for the maximum threshold");
+
+SiteThrottle::SiteThrottle(uint32_t threshold)
+  : threshold_(threshold), entries_(kEntriesCount, 0) {
+}
+
+bool SiteThrottle::ShouldEvaluate(size_t pc, uint32_t generation) {
+  uint64_t *entry = GetEntry(pc);
+  if ((*entry >> (kStreakBits + kSkipBits)) != GetTag(pc, generation) ||
+      (*entry & kSkipMask) == 0) {
+    return true;
+  }
+
+  (*entry)--;
+  return false;
+}
+
+void SiteThrottle::Report(size_t pc, uint32_t generation, bool progress) {
+  uint64_t *entry = GetEntry(pc);
+  const uint64_t tag = GetTag(pc, generation);
+
+  uint32_t streak = 0;
+  if (!progress) {
+    if ((*entry >> (kStreakBits + kSkipBits)) == tag) {
+      streak = (*entry >> kSkipBits) & kMaxStreak;
+    }
+    streak = std::min(streak + 1, kMaxStreak);
+  }
+
+  // Double the number of skipped executions with every evaluation without
+  // progress beyond the threshold.
+  uint32_t skip = 0;
+  if (streak >= threshold_) {
+    const uint32_t exponent = std::min<uint32_t>(streak - threshold_,
+                                                 kSkipBits);
+    skip = std::min((1U << exponent), kMaxSkip);
+  }
+
+  *entry = (tag << (kStreakBits + kSkipBits)) |
+           (static_cast<uint64_t>(streak) << kSkipBits) | skip;
+}
+
+uint64_t *SiteThrottle::GetEntry(size_t pc) {
+  return &entries_[pc & (kEntriesCount - 1)];
+}
+
+uint64_t SiteThrottle::GetTag(size_t pc, uint32_t generation) {
+  return ((static_cast<uint64_t>(pc) >> kIndexBits) &
+          ((1ULL << kTagAddressBits) - 1)) |
+         (static_cast<uint64_t>(generation & 0xFFFF) << kTagAddressBits);
+}
@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A per-thread sampling policy for hot comparison sites. Every site (i.e. the
+// address of a comparison) is evaluated normally until it has been executed
+// a configured number of times in a row without making any progress, i.e.
+// without a chance of producing new traces. From then on, the following
+// executions are skipped with an exponential back-off: the site is
+// re-evaluated after 1, 2, 4, ... skipped executions, up to a limit, so that
+// the coverage can still progress if the compared values change over time.
+// Any progress brings the site back to normal evaluation.
+//
+// The state is kept in a small, direct-mapped table owned by a single thread,
+// so it doesn't need any synchronization. Colliding sites simply evict each
+// other's state.
+
+#ifndef CMPCOV_SITE_THROTTLE_H_
+#define CMPCOV_SITE_THROTTLE_H_
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "arena.h"
+
+class SiteThrottle {
+ public:
+  // The largest supported threshold, limited by the width of the streak
+  // counter kept in every table entry, which must also fit the evaluations of
+  // the back-off beyond the threshold.
+  static const uint32_t kMaxThreshold = 239;
+
+  // Creates a policy which starts skipping the executions of a site after
+  // |threshold| consecutive executions without progress, where |threshold| is
+  // in the range of 1 to kMaxThreshold.
+  explicit SiteThrottle(uint32_t threshold);
+
+  // Checks if the site should be evaluated in the current execution. The
+  // decision is counted as a skipped execution if it's negative. |generation|
+  // identifies the current state of the traces (see cmpcov_reset), and the
+  // entries of older generations are ignored. Only the lower 16 bits of the
+  // generation are kept in the entries, so an entry untouched for a multiple
+  // of 65536 resets is taken for a current one, and the site may skip the
+  // executions left in its old back-off before it's evaluated again.
+  bool ShouldEvaluate(size_t pc, uint32_t generation);
+
+  // Records the outcome of an evaluation of the site.
+  void Report(size_t pc, uint32_t generation, bool progress);
+
+ private:
+  // Returns the entry assigned to the site, and the tag identifying the site
+  // and generation in the entry.
+  uint64_t *GetEntry(size_t pc);
+  static uint64_t GetTag(size_t pc, uint32_t generation);
+
+  const uint32_t threshold_;
+  ArenaVector<uint64_t> entries_;
+};
+
+#endif  // CMPCOV_SITE_THROTTLE_H_
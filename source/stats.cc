@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "stats.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "arena.h"
+
+namespace {
+
+const char *kStatNames[kStatsCount] = {
+  "cmp2_calls",
+  "cmp4_calls",
+  "cmp8_calls",
+  "const_cmp2_calls",
+  "const_cmp4_calls",
+  "const_cmp8_calls",
+  "switch_calls",
+  "memcmp_calls",
+  "strncmp_calls",
+  "strcmp_calls",
+  "pc_guard_calls",
+  "small_const_skipped",
+  "empty_switch_skipped",
+  "long_data_skipped",
+  "no_match_skipped",
+  "saturated_skipped",
+  "sampled_skipped",
+  "denylist_skipped",
+  "module_filter_skipped",
+  "switch_cache_misses",
+  "traces_new",
+  "traces_duplicate",
+  "traces_over_limit",
+  "traces_baseline",
+  "traces_unpackable",
+  "traces_host_duplicate",
+  "module_cache_misses",
+  "module_updates",
+  "module_resolves",
+  "lock_contended",
+  "lock_wait_ns",
+  "lock_busy_skipped",
+};
+
+struct ThreadCounters;
+
+// The counters of all live threads, and the sums of the counters of the threads
+// which have exited. Allocated on first use and never destroyed, as they may be
+// accessed until the very end of the process. The threads register themselves
+// from the callbacks, so the list is kept in the arena.
+struct Registry {
+  std::mutex mutex;
+  ArenaVector<ThreadCounters *> threads;
+  uint64_t retired[kStatsCount];
+};
+
+Registry *GetRegistry() {
+  static Registry *registry = ArenaNew<Registry>();
+  return registry;
+}
+
+struct ThreadCounters {
+  ThreadCounters() {
+    Registry *registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    registry->threads.push_back(this);
+  }
+
+  ~ThreadCounters() {
+    Registry *registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    for (int i = 0; i < kStatsCount; i++) {
+      registry->retired[i] += values[i].load(std::memory_order_relaxed);
+    }
+
+    auto& threads = registry->threads;
+    threads.erase(std::remove(threads.begin(), threads.end(), this),
+                  threads.end());
+  }
+
+  // The counters are only written by the owning thread, so they don't need
+  // atomic read-modify-write operations; the atomic type only makes it safe to
+  // read them from other threads.
+  std::atomic<uint64_t> values[kStatsCount];
+};
+
+thread_local ThreadCounters thread_counters;
+
+}  // namespace
+
+namespace stats_internal {
+  std::atomic<bool> enabled;
+
+  void Increment(Stat stat, uint64_t value) {
+    std::atomic<uint64_t>& counter = thread_counters.values[stat];
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+}  // namespace stats_internal
+
+void EnableStats() {
+  stats_internal::enabled.store(true, std::memory_order_relaxed);
+}
+
+const char *GetStatName(Stat stat) {
+  return kStatNames[stat];
+}
+
+void GetStats(uint64_t totals[kStatsCount]) {
+  Registry *registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+
+  std::copy(registry->retired, registry->retired + kStatsCount, totals);
+  for (const ThreadCounters *thread : registry->threads) {
+    for (int i = 0; i < kStatsCount; i++) {
+      totals[i] += thread->values[i].load(std::memory_order_relaxed);
+    }
+  }
+}
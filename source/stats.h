@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// Optional counters of the internal events in cmpcov, such as invocations of
+// the particular callbacks, reasons for skipping comparisons, deduplication
+// hits and contention on the global lock. The counters are kept per thread and
+// summed up when they are reported, so that incrementing them doesn't involve
+// any shared cache lines. When the statistics are disabled, incrementing a
+// counter only costs a load and a branch.
+
+#ifndef CMPCOV_STATS_H_
+#define CMPCOV_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+enum Stat {
+  // Invocations of the instrumentation callbacks.
+  kStatCmp2Calls,
+  kStatCmp4Calls,
+  kStatCmp8Calls,
+  kStatConstCmp2Calls,
+  kStatConstCmp4Calls,
+  kStatConstCmp8Calls,
+  kStatSwitchCalls,
+  kStatMemcmpCalls,
+  kStatStrncmpCalls,
+  kStatStrcmpCalls,
+  kStatPcGuardCalls,
+
+  // Comparisons skipped early, before looking for any traces.
+  kStatSmallConstSkipped,
+  kStatEmptySwitchSkipped,
+  kStatLongDataSkipped,
+  kStatNoMatchSkipped,
+  kStatSaturatedSkipped,
+  kStatSampledSkipped,
+  kStatDenylistSkipped,
+  kStatModuleFilterSkipped,
+
+  // Switch statements preprocessed and added to the switch case cache.
+  kStatSwitchCacheMisses,
+
+  // Results of the trace deduplication in the Traces class, the traces dropped
+  // after reaching the memory limit, the traces found in the baseline, the
+  // traces which couldn't be packed (see Traces::PackTrace), and the traces
+  // already seen by other processes on the host.
+  kStatTracesNew,
+  kStatTracesDuplicate,
+  kStatTracesOverLimit,
+  kStatTracesBaseline,
+  kStatTracesUnpackable,
+  kStatTracesHostDuplicate,
+
+  // Lookups of addresses not found in the most recently used module range,
+  // updates of the module list from the operating system, and lookups of
+  // modules not resolved in the module filter yet.
+  kStatModuleCacheMisses,
+  kStatModuleUpdates,
+  kStatModuleResolves,
+
+  // Contention on the global lock: the number of times it was found taken and
+  // waited for, the total time of the waits in nanoseconds, and the number of
+  // comparisons dropped because the lock was taken.
+  kStatLockContended,
+  kStatLockWaitNs,
+  kStatLockBusySkipped,
+
+  kStatsCount
+};
+
+namespace stats_internal {
+  extern std::atomic<bool> enabled;
+
+  void Increment(Stat stat, uint64_t value);
+}  // namespace stats_internal
+
+// Enables the collection of statistics.
+void EnableStats();
+
+// Checks if the collection of statistics is enabled.
+inline bool StatsEnabled() {
+  return stats_internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Adds |value| to the counter of the current thread, if the statistics are
+// enabled.
+inline void CountStat(Stat stat, uint64_t value = 1) {
+  if (StatsEnabled()) {
+    stats_internal::Increment(stat, value);
+  }
+}
+
+// Returns the name of a counter, e.g. "cmp2_calls".
+const char *GetStatName(Stat stat);
+
+// Sums up the counters of all threads, including the ones which have exited.
+void GetStats(uint64_t totals[kStatsCount]);
+
+#endif  // CMPCOV_STATS_H_
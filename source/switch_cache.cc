@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "switch_cache.h"
+
+#include "common.h"
+#include "stats.h"
+
+// The number of slots in the cache, and the number of slots probed for every
+// switch before giving up.
+static const int kIndexBits = 14;
+static const size_t kSlotsCount = 1 << kIndexBits;
+static const size_t kMaxProbes = 16;
+
+SwitchCache::SwitchCache()
+  : slots_(new std::atomic<Entry *>[kSlotsCount]()) {
+}
+
+const SwitchCache::Entry *SwitchCache::Get(const uint64_t *cases) {
+  Entry *new_entry = nullptr;
+
+  const size_t index = GetIndex(cases);
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    std::atomic<Entry *> *slot = &slots_[(index + i) & (kSlotsCount - 1)];
+
+    Entry *entry = slot->load(std::memory_order_acquire);
+    if (entry == nullptr) {
+      if (new_entry == nullptr) {
+        CountStat(kStatSwitchCacheMisses);
+        new_entry = CreateEntry(cases);
+      }
+
+      // If another thread has just filled the slot, check its entry like
+      // any other.
+      if (slot->compare_exchange_strong(entry, new_entry,
+                                        std::memory_order_acq_rel)) {
+        return new_entry;
+      }
+    }
+
+    if (entry->cases == cases) {
+      ArenaDelete(new_entry);
+
+      // The array may belong to a module loaded at the address of an unloaded
+      // one, in which case the entry is stale and can't be used.
+      if (entry->cases_count != cases[0]) {
+        return nullptr;
+      }
+      return entry;
+    }
+  }
+
+  ArenaDelete(new_entry);
+  return nullptr;
+}
+
+size_t SwitchCache::GetIndex(const uint64_t *cases) {
+  const uint64_t address = reinterpret_cast<uintptr_t>(cases) >> 3;
+  return (address * 0x9E3779B97F4A7C15ULL) >> (64 - kIndexBits);
+}
+
+SwitchCache::Entry *SwitchCache::CreateEntry(const uint64_t *cases) {
+  Entry *entry = ArenaNew<Entry>();
+  entry->cases = cases;
+  entry->cases_count = cases[0];
+
+  for (uint64_t i = 0; i < cases[0]; i++) {
+    const uint64_t value = cases[2 + i];
+
+    // Similarly to regular cmp instructions, we're not interested in
+    // instrumenting switch cases with 1-byte constants.
+    if (value < 0x100) {
+      continue;
+    }
+
+    Case wide_case;
+    wide_case.index = static_cast<uint32_t>(i);
+    wide_case.width = GetUint64Width(value);
+    entry->wide_cases.push_back(wide_case);
+  }
+
+  return entry;
+}
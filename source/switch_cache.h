@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A cache of the preprocessed case constants of switch statements, keyed by
+// the address of the Cases[] array passed to __sanitizer_cov_trace_switch. For
+// every switch, it stores the indexes and widths of only the "wide" cases
+// (i.e. with constants of at least two bytes), so that repeated executions of
+// large switches with mostly narrow cases don't have to scan and measure all
+// of the constants again.
+//
+// The entries are immutable once published, and are looked up without locking.
+// The table is never cleared and entries are never evicted, so there is an
+// upper limit on the number of cached switches; when it is reached, the
+// callers fall back to scanning the Cases[] arrays.
+
+#ifndef CMPCOV_SWITCH_CACHE_H_
+#define CMPCOV_SWITCH_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "arena.h"
+
+class SwitchCache {
+ public:
+  // A single wide case of a switch statement.
+  struct Case {
+    // Index of the case in the constants of the switch, i.e. Cases[2 + index].
+    uint32_t index;
+
+    // Width of the case constant in bytes.
+    int width;
+  };
+
+  // The preprocessed cases of a single switch statement.
+  struct Entry {
+    // The Cases[] array of the switch, and the number of its cases at the time
+    // of preprocessing.
+    const uint64_t *cases;
+    uint64_t cases_count;
+
+    // The wide cases of the switch, in the original order.
+    ArenaVector<Case> wide_cases;
+  };
+
+  SwitchCache();
+
+  // Returns the preprocessed cases of the switch described by |cases|,
+  // creating them on first use. Returns nullptr if the switch isn't cached and
+  // there is no more room in the cache.
+  const Entry *Get(const uint64_t *cases);
+
+ private:
+  // Returns the index of the first slot probed for the switch.
+  static size_t GetIndex(const uint64_t *cases);
+
+  // Builds a new entry describing the switch.
+  static Entry *CreateEntry(const uint64_t *cases);
+
+  std::unique_ptr<std::atomic<Entry *>[]> slots_;
+};
+
+#endif  // CMPCOV_SWITCH_CACHE_H_
@@ -0,0 +1,67 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "thread_traces.h"
+
+#include "stats.h"
+#include "traces.h"
+
+// The bits of wide traces holding the address, see Traces::ConstructWideTrace.
+static const uint64_t kWideTraceAddressMask = (1ULL << 48) - 1;
+
+void ThreadTraces::TrySaveTrace(size_t pc, int trace_arg1, int trace_arg2) {
+  if (traces_table_.size() >= max_traces_) {
+    CountStat(kStatTracesOverLimit);
+    Traces::ReportTraceLimitReached();
+    return;
+  }
+
+  // Deduplicate the trace locally, so that we don't keep the same address in
+  // the buffer more than once.
+  uint64_t trace = Traces::ConstructWideTrace(pc, trace_arg1, trace_arg2);
+  if (!traces_table_.Insert(trace)) {
+    return;
+  }
+
+  pending_traces_.push_back(trace);
+}
+
+void ThreadTraces::TrySaveTraces(size_t pc, int trace_arg1, int trace_arg2,
+                                 int count, Traces::DepthArg depth_arg) {
+  const int arg1_step = (depth_arg == Traces::DepthArg::kArg1) ? 1 : 0;
+  const int arg2_step = (depth_arg == Traces::DepthArg::kArg2) ? 1 : 0;
+
+  for (int i = 0; i < count; i++) {
+    TrySaveTrace(pc, trace_arg1 - i * arg1_step, trace_arg2 - i * arg2_step);
+  }
+}
+
+void ThreadTraces::MergeInto(Traces *traces) {
+  for (uint64_t trace : pending_traces_) {
+    traces->TrySaveTrace(static_cast<size_t>(trace & kWideTraceAddressMask),
+                         static_cast<int>(trace >> 60),
+                         static_cast<int>((trace >> 48) & 0xFFF));
+  }
+  pending_traces_.clear();
+}
+
+void ThreadTraces::Reset() {
+  traces_table_.Clear();
+  pending_traces_.clear();
+}
@@ -0,0 +1,80 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A per-thread buffer of code coverage traces, which makes it possible to
+// record traces without synchronizing with other threads of the process. The
+// traces are only translated to the base+offset form and merged into the
+// global Traces object when the coverage is dumped, or the thread exits.
+
+#ifndef CMPCOV_THREAD_TRACES_H_
+#define CMPCOV_THREAD_TRACES_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+#include "arena.h"
+#include "trace_table.h"
+#include "traces.h"
+
+class ThreadTraces {
+ public:
+  // Creates a buffer with a deduplication table preallocated for at least
+  // |table_capacity| unique traces. At most |max_traces| unique traces are
+  // saved, after which the new ones are dropped.
+  ThreadTraces(size_t table_capacity, size_t max_traces)
+    : traces_table_(table_capacity), max_traces_(max_traces) { }
+
+  // Saves an execution trace in the local buffer, with the same semantics as
+  // Traces::TrySaveTrace.
+  void TrySaveTrace(size_t pc, int trace_arg1, int trace_arg2);
+
+  // Saves a series of execution traces in the local buffer, with the same
+  // semantics as Traces::TrySaveTraces.
+  void TrySaveTraces(size_t pc, int trace_arg1, int trace_arg2, int count,
+                     Traces::DepthArg depth_arg);
+
+  // Passes all traces saved since the previous call to the specified Traces
+  // object.
+  void MergeInto(Traces *traces);
+
+  // Forgets all traces saved in the buffer so far.
+  void Reset();
+
+  // Returns the mutex guarding the buffer. It is normally only acquired by the
+  // owning thread, and thus only contended while the buffer is being merged.
+  std::mutex& mutex() { return mutex_; }
+
+ private:
+  std::mutex mutex_;
+
+  // A set of unique wide traces logged by the thread so far.
+  TraceTable traces_table_;
+
+  // The maximum number of unique traces in traces_table_.
+  size_t max_traces_;
+
+  // A list of wide traces which haven't been merged yet. The wide form holds
+  // the complete address and arguments of the traces.
+  ArenaVector<uint64_t> pending_traces_;
+};
+
+#endif  // CMPCOV_THREAD_TRACES_H_
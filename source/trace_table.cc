@@ -0,0 +1,124 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "trace_table.h"
+
+#include <utility>
+#include <vector>
+
+// The value used to mark empty slots. A trace with this value is tracked
+// separately, outside of the slots array.
+static const uint64_t kEmptySlot = 0;
+
+TraceTable::TraceTable(size_t capacity)
+  : hash_shift_(64), size_(0), has_empty_value_(false) {
+  // Keep the load factor at or below 50%, so that the linear probing sequences
+  // remain short.
+  size_t slots_count = 16;
+  while (slots_count < capacity * 2) {
+    slots_count *= 2;
+  }
+  AllocateSlots(slots_count);
+  used_slots_.reserve(capacity);
+}
+
+bool TraceTable::Insert(uint64_t trace) {
+  if (trace == kEmptySlot) {
+    if (has_empty_value_) {
+      return false;
+    }
+    has_empty_value_ = true;
+    size_++;
+    return true;
+  }
+
+  const size_t mask = slots_.size() - 1;
+  for (size_t idx = GetStartIndex(trace); ; idx = (idx + 1) & mask) {
+    if (slots_[idx] == trace) {
+      return false;
+    } else if (slots_[idx] == kEmptySlot) {
+      slots_[idx] = trace;
+      used_slots_.push_back(idx);
+      break;
+    }
+  }
+
+  if (++size_ * 2 > slots_.size()) {
+    Grow();
+  }
+  return true;
+}
+
+bool TraceTable::Contains(uint64_t trace) const {
+  if (trace == kEmptySlot) {
+    return has_empty_value_;
+  }
+
+  const size_t mask = slots_.size() - 1;
+  for (size_t idx = GetStartIndex(trace); slots_[idx] != kEmptySlot;
+       idx = (idx + 1) & mask) {
+    if (slots_[idx] == trace) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TraceTable::Clear() {
+  for (uint32_t idx : used_slots_) {
+    slots_[idx] = kEmptySlot;
+  }
+  used_slots_.clear();
+
+  size_ = 0;
+  has_empty_value_ = false;
+}
+
+size_t TraceTable::GetStartIndex(uint64_t trace) const {
+  // Fibonacci hashing, which uses the upper bits of the product and therefore
+  // mixes both the address and the argument bits of the trace.
+  return (trace * 0x9E3779B97F4A7C15ULL) >> hash_shift_;
+}
+
+void TraceTable::AllocateSlots(size_t slots_count) {
+  slots_.assign(slots_count, kEmptySlot);
+
+  hash_shift_ = 64;
+  for (size_t i = slots_count; i > 1; i /= 2) {
+    hash_shift_--;
+  }
+}
+
+void TraceTable::Grow() {
+  ArenaVector<uint64_t> old_slots;
+  old_slots.swap(slots_);
+  AllocateSlots(old_slots.size() * 2);
+
+  const size_t mask = slots_.size() - 1;
+  for (uint32_t& used_idx : used_slots_) {
+    const uint64_t trace = old_slots[used_idx];
+
+    size_t idx = GetStartIndex(trace);
+    while (slots_[idx] != kEmptySlot) {
+      idx = (idx + 1) & mask;
+    }
+    slots_[idx] = trace;
+    used_idx = idx;
+  }
+}
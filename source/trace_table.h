@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Description
+// ===========
+//
+// A flat, open-addressing hash set of 64-bit wide traces, used for trace
+// deduplication. All slots are allocated upfront, so that looking up a trace
+// which has already been seen typically takes a single cache line access, and
+// no memory is allocated when new traces are inserted.
+
+#ifndef CMPCOV_TRACE_TABLE_H_
+#define CMPCOV_TRACE_TABLE_H_
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "arena.h"
+
+class TraceTable {
+ public:
+  // Creates a table able to hold at least |capacity| traces. If the capacity is
+  // exceeded, the table is transparently resized.
+  explicit TraceTable(size_t capacity);
+
+  // Inserts a trace into the table. Returns true if the trace was not present
+  // in the table before, and false otherwise.
+  bool Insert(uint64_t trace);
+
+  // Checks if the trace is present in the table.
+  bool Contains(uint64_t trace) const;
+
+  // Removes all traces from the table. The operation takes time proportional
+  // to the number of traces in the table, and not to its capacity.
+  void Clear();
+
+  // Returns the number of traces in the table.
+  size_t size() const { return size_; }
+
+ private:
+  // The table slots, the number of which is always a power of two.
+  ArenaVector<uint64_t> slots_;
+
+  // Indexes of all occupied slots, used to clear the table quickly.
+  ArenaVector<uint32_t> used_slots_;
+
+  // The shift used to translate a 64-bit hash into a slot index.
+  int hash_shift_;
+
+  // The number of traces in the table.
+  size_t size_;
+
+  // Indicates if a trace equal to the value marking empty slots has been
+  // inserted.
+  bool has_empty_value_;
+
+  // Returns the slot index at which the lookup of a trace starts.
+  size_t GetStartIndex(uint64_t trace) const;
+
+  // Allocates the slots array with the specified number of slots.
+  void AllocateSlots(size_t slots_count);
+
+  // Doubles the number of slots, and reinserts all traces.
+  void Grow();
+};
+
+#endif  // CMPCOV_TRACE_TABLE_H_
@@ -21,48 +21,220 @@
 
 #include <inttypes.h>
 
+#include <atomic>
+#include <cstdio>
+
 #include "common.h"
 #include "modules.h"
+#include "stats.h"
+
+#if WORDSIZE == 64
+// The bits of packed 64-bit traces holding the module index, see PackTrace.
+static const int kPackedModuleShift = 36;
+static const uint64_t kMaxPackedModuleIndex = (1ULL << 12) - 1;
+static const uint64_t kPackedModuleMask =
+    kMaxPackedModuleIndex << kPackedModuleShift;
+#endif
+
+// Marks the modules not looked up in the baseline yet, see baseline_indexes_.
+static const int kUnresolvedBaseline = -2;
 
 void Traces::TrySaveTrace(size_t pc, int trace_arg1, int trace_arg2) {
-  // Form a wide (64-bit) representation of the trace for internal
-  // deduplication.
-  uint64_t trace = ConstructWideTrace(pc, trace_arg1, trace_arg2);
-
-  // First line of deduplication - a set of traces operating on the binary
-  // representation.
-  if (traces_set_.find(trace) != traces_set_.end()) {
-    return;
-  }
-  traces_set_.insert(trace);
+  TrySaveTraces(pc, trace_arg1, trace_arg2, /*count=*/1, DepthArg::kArg1);
+}
+
+void Traces::TrySaveTraces(size_t pc, int trace_arg1, int trace_arg2,
+                           int count, DepthArg depth_arg) {
+  const int arg1_step = (depth_arg == DepthArg::kArg1) ? 1 : 0;
+  const int arg2_step = (depth_arg == DepthArg::kArg2) ? 1 : 0;
+
+  // The module is only looked up once the first new trace is found.
+  int mod_idx = -1;
+  size_t offset = 0;
+  uint64_t module_id = 0;
+  int baseline_idx = -1;
+
+  for (int i = 0; i < count; i++) {
+    const int arg1 = trace_arg1 - i * arg1_step;
+    const int arg2 = trace_arg2 - i * arg2_step;
+
+    // Stop recording once the memory limit is reached. The dropped traces may
+    // include duplicates, as the table isn't even looked up.
+    if (traces_table_.size() >= max_traces_) {
+      CountStat(kStatTracesOverLimit, count - i);
+      ReportTraceLimitReached();
+      return;
+    }
+
+    // First line of deduplication - a set of wide (64-bit) traces operating on
+    // the binary representation.
+    if (!traces_table_.Insert(ConstructWideTrace(pc, arg1, arg2))) {
+      CountStat(kStatTracesDuplicate);
+      continue;
+    }
+    CountStat(kStatTracesNew);
+
+    // Translate the instruction address to an executable image in memory.
+    if (mod_idx == -1) {
+      mod_idx = modules_->GetModuleIndex(pc);
+      if (mod_idx == -1) {
+        Die("Failed to translate address %zx to an executable image, "
+            "aborting.\n", pc);
+      }
+      offset = pc - modules_->GetModuleBaseAddress(mod_idx);
+      module_id = modules_->GetModuleId(mod_idx);
 
-  // Translate the instruction address to an executable image in memory.
-  int mod_idx = modules_->GetModuleIndex(pc);
-  if (mod_idx == -1) {
-    Die("Failed to translate address %zx to an executable image, aborting.\n",
-        pc);
+      if (baseline_ != nullptr) {
+        baseline_idx = GetBaselineIndex(mod_idx);
+      }
+    }
+
+    // Construct an output trace (might be slightly different from a wide one)
+    // and save it to be dumped to disk later, unless it's in the baseline. The
+    // wide trace remains in the table, so the baseline is only checked once.
+    size_t output_trace = ConstructOutputTrace(offset, arg1, arg2);
+    if (baseline_idx != -1 && baseline_->Contains(baseline_idx, output_trace)) {
+      CountStat(kStatTracesBaseline);
+      continue;
+    }
+
+    // Traces which don't fit in the packed form are dropped, similarly to the
+    // ones over the memory limit.
+    uint64_t packed_trace;
+    if (!PackTrace(mod_idx, output_trace, &packed_trace)) {
+      CountStat(kStatTracesUnpackable);
+      ReportUnpackableTrace(mod_idx, output_trace);
+      continue;
+    }
+
+    // The same goes for the traces already found by other processes on the
+    // host. The local table is checked first, so that known traces don't touch
+    // the shared cache lines of the host-wide one.
+    if (host_table_ != nullptr &&
+        !host_table_->Insert(module_id, output_trace)) {
+      CountStat(kStatTracesHostDuplicate);
+      continue;
+    }
+
+    traces_list_.push_back(packed_trace);
+
+    // Traces found again after a reset have already been saved to the
+    // persistent outputs.
+    if (saved_traces_tracked_ && !saved_traces_.Insert(packed_trace)) {
+      continue;
+    }
+
+    if (flush_queue_enabled_) {
+      flush_queue_.push_back(packed_trace);
+    }
+
+    if (shared_traces_ != nullptr) {
+      shared_traces_->Append(module_id, output_trace);
+    }
+
+    if (mapped_traces_ != nullptr) {
+      if (!mapped_traces_->HasModule(mod_idx)) {
+        mapped_traces_->AddModule(mod_idx,
+                                  modules_->GetModuleName(mod_idx).c_str());
+      }
+      mapped_traces_->Append(mod_idx, output_trace);
+    }
   }
+}
 
-  // Construct an output trace (might be slightly different from a wide one) and
-  // save it to be dumped to disk later.
-  size_t output_trace = ConstructOutputTrace(
-      pc - modules_->GetModuleBaseAddress(mod_idx),
-      trace_arg1, trace_arg2);
+int Traces::GetBaselineIndex(int mod_idx) {
+  if (mod_idx >= baseline_indexes_.size()) {
+    baseline_indexes_.resize(mod_idx + 1, kUnresolvedBaseline);
+  }
 
-  traces_list_.push_back(std::make_pair(mod_idx, output_trace));
+  if (baseline_indexes_[mod_idx] == kUnresolvedBaseline) {
+    baseline_indexes_[mod_idx] =
+        baseline_->FindModule(modules_->GetModuleName(mod_idx).c_str());
+  }
+  return baseline_indexes_[mod_idx];
 }
 
 int Traces::GetModulesCount() const {
   return modules_->GetModulesCount();
 }
 
-std::string Traces::GetModuleName(int idx) const {
+const ArenaString& Traces::GetModuleName(int idx) const {
   return modules_->GetModuleName(idx);
 }
 
-void Traces::GetTracesList(
-    std::vector<std::pair<int, size_t>> *traces_list) const {
-  *traces_list = traces_list_;
+size_t Traces::GetModuleBaseAddress(int idx) const {
+  return modules_->GetModuleBaseAddress(idx);
+}
+
+size_t Traces::GetModuleSize(int idx) const {
+  return modules_->GetModuleSize(idx);
+}
+
+bool Traces::TranslateAddress(size_t pc, int *module_index, size_t *offset) {
+  const int idx = modules_->GetModuleIndex(pc);
+  if (idx == -1) {
+    return false;
+  }
+
+  *module_index = idx;
+  *offset = pc - modules_->GetModuleBaseAddress(idx);
+  return true;
+}
+
+void Traces::Reset() {
+  if (HasPersistentOutputs()) {
+    for (uint64_t packed_trace : traces_list_) {
+      saved_traces_.Insert(packed_trace);
+    }
+    saved_traces_tracked_ = true;
+  }
+
+  traces_table_.Clear();
+  traces_list_.clear();
+}
+
+bool Traces::PackTrace(int module_index, size_t output_trace,
+                       uint64_t *packed_trace) {
+#if WORDSIZE == 64
+  if ((output_trace & kPackedModuleMask) != 0 ||
+      module_index > static_cast<int>(kMaxPackedModuleIndex)) {
+    return false;
+  }
+  *packed_trace = output_trace |
+                  (static_cast<uint64_t>(module_index) << kPackedModuleShift);
+#else
+  *packed_trace = output_trace | (static_cast<uint64_t>(module_index) << 32);
+#endif
+  return true;
+}
+
+std::pair<int, size_t> Traces::UnpackTrace(uint64_t packed_trace) {
+#if WORDSIZE == 64
+  return std::make_pair(
+      static_cast<int>((packed_trace & kPackedModuleMask) >>
+                       kPackedModuleShift),
+      static_cast<size_t>(packed_trace & ~kPackedModuleMask));
+#else
+  return std::make_pair(static_cast<int>(packed_trace >> 32),
+                        static_cast<size_t>(packed_trace));
+#endif
+}
+
+void Traces::ReportTraceLimitReached() {
+  static std::atomic<bool> reported;
+  if (!reported.exchange(true)) {
+    fprintf(stderr, "CmpSanitizerCoverage: the memory limit has been reached, "
+                    "no more traces will be recorded.\n");
+  }
+}
+
+void Traces::ReportUnpackableTrace(int module_index, size_t output_trace) {
+  static std::atomic<bool> reported;
+  if (!reported.exchange(true)) {
+    fprintf(stderr, "CmpSanitizerCoverage: unable to store the trace %zx of "
+                    "module #%d, such traces will be dropped.\n",
+            output_trace, module_index);
+  }
 }
 
 // 64-bit --> 32-bit hash function by Thomas Wang, source:
@@ -28,48 +28,215 @@
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
-#include <unordered_set>
-#include <vector>
 
+#include "arena.h"
+#include "baseline_traces.h"
+#include "host_trace_table.h"
+#include "mapped_traces.h"
 #include "modules.h"
+#include "shared_traces.h"
+#include "trace_table.h"
 
 class Traces {
  public:
-  Traces() : modules_(std::make_unique<Modules>()) { }
+  // Creates an object with a deduplication table preallocated for at least
+  // |table_capacity| unique traces. At most |max_traces| unique traces are
+  // recorded, after which the new ones are dropped.
+  Traces(size_t table_capacity, size_t max_traces)
+    : traces_table_(table_capacity), max_traces_(max_traces),
+      modules_(std::make_unique<Modules>()), shared_traces_(nullptr),
+      mapped_traces_(nullptr), baseline_(nullptr), host_table_(nullptr),
+      flush_queue_enabled_(false), saved_traces_(/*capacity=*/0),
+      saved_traces_tracked_(false) { }
+
+  // Makes the object also append new traces to a shared memory region. The
+  // object doesn't take ownership of |shared_traces|.
+  void SetSharedTraces(SharedTraces *shared_traces) {
+    shared_traces_ = shared_traces;
+  }
+
+  // Makes the object also save new traces to memory-mapped output files. The
+  // object doesn't take ownership of |mapped_traces|.
+  void SetMappedTraces(MappedTraces *mapped_traces) {
+    mapped_traces_ = mapped_traces;
+  }
+
+  // Makes the object treat the traces found in |baseline| as already seen, so
+  // that they are never saved. The object doesn't take ownership of
+  // |baseline|.
+  void SetBaseline(const BaselineTraces *baseline) {
+    baseline_ = baseline;
+  }
+
+  // Makes the object treat the traces already inserted into |host_table| by any
+  // process as seen, and insert the new ones. The object doesn't take ownership
+  // of |host_table|.
+  void SetHostTable(HostTraceTable *host_table) {
+    host_table_ = host_table;
+  }
+
+  // Makes the object also queue the new traces for an incremental flush to
+  // disk, see SwapFlushQueue.
+  void EnableFlushQueue() {
+    flush_queue_enabled_ = true;
+  }
+
+  // Exchanges the list of packed traces queued since the previous call with the
+  // contents of |flush_queue|, which should normally be empty.
+  void SwapFlushQueue(ArenaVector<uint64_t> *flush_queue) {
+    flush_queue_.swap(*flush_queue);
+  }
 
   // Saves an execution trace based on a virtual address, and two arguments: a
   // 4-bit and a 12-bit one. The meaning of the arguments is up to the caller.
   void TrySaveTrace(size_t pc, int trace_arg1, int trace_arg2);
 
+  // Identifies the argument of the traces decremented by TrySaveTraces.
+  enum class DepthArg { kArg1, kArg2 };
+
+  // Saves |count| execution traces for the same virtual address: the first one
+  // with the specified arguments, and each next one with the |depth_arg|
+  // argument smaller by one. The address is translated to a module only once.
+  void TrySaveTraces(size_t pc, int trace_arg1, int trace_arg2, int count,
+                     DepthArg depth_arg);
+
+  // Registers all modules currently loaded in the process, see
+  // Modules::Preload.
+  void PreloadModules() {
+    modules_->Preload();
+  }
+
   // Returns the number of modules in which execution traces have been
   // registered.
   int GetModulesCount() const;
 
   // Returns the name of a specific module.
-  std::string GetModuleName(int idx) const;
+  const ArenaString& GetModuleName(int idx) const;
+
+  // Returns the base address and size of a specific module.
+  size_t GetModuleBaseAddress(int idx) const;
+  size_t GetModuleSize(int idx) const;
+
+  // Translates an address to the index of the module it belongs to, and the
+  // offset within the module. Returns false if the address doesn't belong to
+  // any known module.
+  bool TranslateAddress(size_t pc, int *module_index, size_t *offset);
+
+  // Returns a list of all traces found so far, in the packed form described in
+  // PackTrace.
+  const ArenaVector<uint64_t>& GetTracesList() const {
+    return traces_list_;
+  }
+
+  // Returns the number of traces found so far.
+  size_t GetTracesCount() const { return traces_list_.size(); }
+
+  // Returns a specific (module index, offset) pair from the list of traces.
+  std::pair<int, size_t> GetTrace(size_t idx) const {
+    return UnpackTrace(traces_list_[idx]);
+  }
+
+  // Forgets all traces found so far, so that they are reported again when they
+  // are encountered next time. The information about modules is preserved, and
+  // so are the traces already saved to the outputs which persist across resets
+  // (the flush queue, the shared memory region and the memory-mapped files),
+  // which don't receive them again.
+  void Reset();
+
+  // Forgets which traces have been saved to the persistent outputs, once they
+  // have been replaced with new ones, e.g. in a forked child.
+  void ForgetSavedTraces() {
+    saved_traces_.Clear();
+    saved_traces_tracked_ = false;
+  }
+
+  // Constructs a wide (64-bit) representation of a trace, used internally for
+  // deduplication.
+  static uint64_t ConstructWideTrace(
+      size_t offset, int trace_arg1, int trace_arg2);
+
+  // Packs a module index and an output trace into a single 64-bit word, in
+  // which the traces are stored in the lists of this class. In 64-bit mode, the
+  // module index takes the place of the upper 12 bits of the 48-bit offset,
+  // which limits the offsets to 64 GiB and the indexes to 4096. Returns false
+  // if the limits are exceeded. In 32-bit mode, the index is stored in the
+  // upper half of the word.
+  static bool PackTrace(int module_index, size_t output_trace,
+                        uint64_t *packed_trace);
+
+  // Reverses PackTrace, returning a (module index, output trace) pair.
+  static std::pair<int, size_t> UnpackTrace(uint64_t packed_trace);
+
+  // An upper bound of the memory used by a single unique trace in this class
+  // or in ThreadTraces, including the unused capacity of the containers. Used
+  // to translate a memory limit into the maximum number of traces.
+  static const size_t kMaxBytesPerTrace = 96;
+
+  // Reports on stderr that the maximum number of traces has been reached, the
+  // first time it is called in the process.
+  static void ReportTraceLimitReached();
 
-  // Returns a list of (module index, offset) pairs that have been found so far.
-  void GetTracesList(std::vector<std::pair<int, size_t>> *traces_list) const;
+  // Reports on stderr that a trace couldn't be packed, the first time it is
+  // called in the process.
+  static void ReportUnpackableTrace(int module_index, size_t output_trace);
 
  private:
   // A set of unique wide traces logged in the process so far.
-  std::unordered_set<uint64_t> traces_set_;
+  TraceTable traces_table_;
 
-  // A list of unique output traces in the form of:
-  //
-  // (module index, offset in module with extra information encoded)
-  //
-  // The module index is generated by the Modules class.
-  std::vector<std::pair<int, size_t>> traces_list_;
+  // The maximum number of unique traces in traces_table_.
+  size_t max_traces_;
+
+  // A list of unique output traces packed together with the indexes of their
+  // modules (generated by the Modules class), in the order they were found.
+  ArenaVector<uint64_t> traces_list_;
 
   // An instance of a class keeping track of executable modules in the process.
   std::unique_ptr<Modules> modules_;
 
-  // Internal methods for constructing wide traces, output traces, and
-  // performing 64->32 bit mixing.
+  // An optional shared memory region receiving the new traces.
+  SharedTraces *shared_traces_;
+
+  // Optional memory-mapped output files receiving the new traces.
+  MappedTraces *mapped_traces_;
+
+  // An optional set of traces treated as already seen.
+  const BaselineTraces *baseline_;
+
+  // Indexes of the baselines of the modules (generated by the Modules class),
+  // -1 for modules without a baseline, or -2 for modules which haven't been
+  // looked up in the baseline yet.
+  ArenaVector<int> baseline_indexes_;
+
+  // Returns the index of the baseline of a module, or -1 if there is none.
+  int GetBaselineIndex(int mod_idx);
+
+  // An optional table of the traces seen by all processes on the host.
+  HostTraceTable *host_table_;
+
+  // Indicates if new traces are also saved in flush_queue_.
+  bool flush_queue_enabled_;
+
+  // A list of traces found since the last call to SwapFlushQueue, in the same
+  // format as traces_list_.
+  ArenaVector<uint64_t> flush_queue_;
+
+  // A set of all packed traces ever saved to the persistent outputs, only
+  // maintained after the first reset, as until then it's equal to the contents
+  // of traces_list_.
+  TraceTable saved_traces_;
+  bool saved_traces_tracked_;
+
+  // Checks if the object saves the traces to any outputs which persist across
+  // resets.
+  bool HasPersistentOutputs() const {
+    return flush_queue_enabled_ || shared_traces_ != nullptr ||
+           mapped_traces_ != nullptr;
+  }
+
+  // Internal methods for constructing output traces, and performing 64->32 bit
+  // mixing.
   static uint32_t Hash_64_32_Shift(uint64_t key);
-  static uint64_t ConstructWideTrace(
-      size_t offset, int trace_arg1, int trace_arg2);
   static size_t ConstructOutputTrace(
       size_t offset, int trace_arg1, int trace_arg2);
 };
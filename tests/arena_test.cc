@@ -0,0 +1,154 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the private memory arena.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../source/arena.h"
+#include "test.h"
+
+namespace {
+
+bool IsAligned(const void *ptr, size_t alignment) {
+  return (reinterpret_cast<uintptr_t>(ptr) & (alignment - 1)) == 0;
+}
+
+// Allocates blocks of various sizes, fills them with distinct patterns and
+// checks that none of them has been overwritten by another. Returns the
+// number of corrupted blocks.
+int CheckDistinctBlocks(int seed) {
+  std::vector<std::pair<uint8_t *, size_t>> blocks;
+  for (int i = 0; i < 500; i++) {
+    const size_t size = 1 + (i * 37 + seed) % 5000;
+    uint8_t *block = static_cast<uint8_t *>(ArenaAllocate(size));
+    memset(block, (i + seed) & 0xFF, size);
+    blocks.emplace_back(block, size);
+  }
+
+  int corrupted_blocks = 0;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    const uint8_t expected = (i + seed) & 0xFF;
+    for (size_t j = 0; j < blocks[i].second; j++) {
+      if (blocks[i].first[j] != expected) {
+        corrupted_blocks++;
+        break;
+      }
+    }
+    ArenaFree(blocks[i].first, blocks[i].second);
+  }
+  return corrupted_blocks;
+}
+
+}  // namespace
+
+TEST(ArenaAlignsBlocks) {
+  const size_t kSizes[] = {0, 1, 8, 15, 16, 17, 100, 4096, 1 << 20};
+  for (size_t size : kSizes) {
+    void *block = ArenaAllocate(size);
+    EXPECT_TRUE(block != nullptr);
+    EXPECT_TRUE(IsAligned(block, 16));
+    ArenaFree(block, size);
+  }
+}
+
+TEST(ArenaReusesFreedBlocksOfSameSizeClass) {
+  // 65 to 128 bytes are served from the same pool.
+  void *block = ArenaAllocate(100);
+  ArenaFree(block, 100);
+  void *reused_block = ArenaAllocate(65);
+  EXPECT_TRUE(reused_block == block);
+
+  // Blocks of other pools are separate.
+  void *other_block = ArenaAllocate(129);
+  EXPECT_TRUE(other_block != block);
+
+  ArenaFree(other_block, 129);
+  ArenaFree(reused_block, 65);
+}
+
+TEST(ArenaKeepsBlocksDistinct) {
+  EXPECT_EQ(CheckDistinctBlocks(0), 0);
+  EXPECT_EQ(CheckDistinctBlocks(1), 0);
+}
+
+TEST(ArenaMapsLargeBlocks) {
+  // The largest pool size is 1 MiB, and larger blocks are mapped separately.
+  const size_t kSizes[] = {(1 << 20) + 1, 3 << 20, 64 << 20};
+  for (size_t size : kSizes) {
+    uint8_t *block = static_cast<uint8_t *>(ArenaAllocate(size));
+    EXPECT_TRUE(IsAligned(block, 4096));
+    memset(block, 0xAB, size);
+    EXPECT_TRUE(block[0] == 0xAB && block[size - 1] == 0xAB);
+    ArenaFree(block, size);
+  }
+
+  // Blocks of exactly the largest pool size are pooled.
+  void *block = ArenaAllocate(1 << 20);
+  ArenaFree(block, 1 << 20);
+  EXPECT_TRUE(ArenaAllocate(1 << 20) == block);
+  ArenaFree(block, 1 << 20);
+}
+
+TEST(ArenaSupportsContainers) {
+  ArenaVector<int> vector;
+  for (int i = 0; i < 100000; i++) {
+    vector.push_back(i);
+  }
+  EXPECT_EQ(vector.size(), 100000u);
+  EXPECT_EQ(vector[99999], 99999);
+
+  ArenaString string(1000, 'x');
+  string += "suffix";
+  EXPECT_EQ(string.size(), 1006u);
+  EXPECT_EQ(string.compare(1000, 6, "suffix"), 0);
+
+  ArenaUnorderedMap<int, int> map;
+  for (int i = 0; i < 1000; i++) {
+    map[i] = i * 2;
+  }
+  EXPECT_EQ(map.size(), 1000u);
+  EXPECT_EQ(map[500], 1000);
+}
+
+TEST(ArenaHandlesConcurrentAllocations) {
+  const int kThreadsCount = 8;
+  std::vector<int> corrupted_blocks(kThreadsCount, 0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadsCount; i++) {
+    threads.emplace_back([&corrupted_blocks, i]() {
+      corrupted_blocks[i] = CheckDistinctBlocks(i);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (int i = 0; i < kThreadsCount; i++) {
+    EXPECT_EQ(corrupted_blocks[i], 0);
+  }
+}
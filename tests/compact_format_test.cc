@@ -0,0 +1,143 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the encoder and decoder of the compact output format.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../source/arena.h"
+#include "../source/common.h"
+#include "../source/compact_format.h"
+#include "test.h"
+
+namespace {
+
+// Encodes |traces| and checks that decoding the output yields the same traces
+// in ascending order.
+bool RoundTrip(const ArenaVector<size_t>& traces) {
+  ArenaVector<size_t> input = traces;
+  ArenaVector<uint8_t> encoded;
+  EncodeCompactTraces(&input, &encoded);
+
+  ArenaVector<size_t> decoded;
+  if (!DecodeCompactTraces(encoded.data(), encoded.size(), &decoded)) {
+    return false;
+  }
+
+  ArenaVector<size_t> expected = traces;
+  std::sort(expected.begin(), expected.end());
+  return decoded == expected;
+}
+
+// Returns the encoding of a few traces spanning two blocks.
+ArenaVector<uint8_t> EncodeSample() {
+  ArenaVector<size_t> traces;
+  for (size_t i = 0; i < kCompactBlockTraces + 10; i++) {
+    traces.push_back(i * 1000);
+  }
+  ArenaVector<uint8_t> encoded;
+  EncodeCompactTraces(&traces, &encoded);
+  return encoded;
+}
+
+}  // namespace
+
+TEST(CompactFormatRoundTripsEmptyList) {
+  ArenaVector<size_t> traces;
+  ArenaVector<uint8_t> encoded;
+  EncodeCompactTraces(&traces, &encoded);
+  EXPECT_EQ(encoded.size(), 2 * sizeof(uint64_t));
+  EXPECT_TRUE(RoundTrip(traces));
+}
+
+TEST(CompactFormatRoundTripsBlockBoundaries) {
+  const size_t kCounts[] = {1, kCompactBlockTraces - 1, kCompactBlockTraces,
+                            kCompactBlockTraces + 1, 5 * kCompactBlockTraces};
+  for (size_t count : kCounts) {
+    ArenaVector<size_t> traces;
+    for (size_t i = 0; i < count; i++) {
+      // Unsorted input with a mix of small and large deltas.
+      traces.push_back((i * 0x9E3779B9) % 0x7FFFFFFF);
+    }
+    EXPECT_TRUE(RoundTrip(traces));
+  }
+}
+
+TEST(CompactFormatRoundTripsExtremeValues) {
+  ArenaVector<size_t> traces = {0, 1, 0x7F, 0x80, 0x3FFF, 0x4000,
+                                static_cast<size_t>(-1),
+                                static_cast<size_t>(-1) - 1,
+                                static_cast<size_t>(-1) / 2};
+  EXPECT_TRUE(RoundTrip(traces));
+}
+
+TEST(CompactFormatWritesHeader) {
+  const ArenaVector<uint8_t> encoded = EncodeSample();
+  uint64_t header[2];
+  memcpy(header, encoded.data(), sizeof(header));
+  EXPECT_EQ(header[0], kCompactMagic);
+  EXPECT_EQ(header[1], kCompactBlockTraces + 10);
+}
+
+TEST(CompactFormatRejectsMalformedData) {
+  const ArenaVector<uint8_t> encoded = EncodeSample();
+  ArenaVector<size_t> decoded;
+
+  // Truncated at any point within the blocks.
+  for (size_t size = 0; size < encoded.size(); size++) {
+    decoded.clear();
+    EXPECT_FALSE(DecodeCompactTraces(encoded.data(), size, &decoded));
+  }
+
+  // A wrong number of traces in the header.
+  ArenaVector<uint8_t> modified = encoded;
+  modified[sizeof(uint64_t)]++;
+  EXPECT_FALSE(DecodeCompactTraces(modified.data(), modified.size(),
+                                   &decoded));
+
+  // A different magic value, e.g. of the other bitness.
+  modified = encoded;
+  const uint64_t magic = (WORDSIZE == 64) ? kCompactMagic32 : kCompactMagic64;
+  memcpy(modified.data(), &magic, sizeof(magic));
+  EXPECT_FALSE(DecodeCompactTraces(modified.data(), modified.size(),
+                                   &decoded));
+}
+
+TEST(CompactFormatRoundTripsBothBitnesses) {
+  const uint64_t kMagics[] = {kCompactMagic64, kCompactMagic32};
+  for (uint64_t magic : kMagics) {
+    std::vector<uint64_t> traces = {0xFFFFFFFFFFFFFFFFULL, 3, 0x100000000ULL};
+    std::vector<uint8_t> encoded;
+    EncodeCompactTraces64(magic, &traces, &encoded);
+
+    uint64_t decoded_magic = 0;
+    std::vector<uint64_t> decoded;
+    EXPECT_TRUE(DecodeCompactTraces64(encoded.data(), encoded.size(),
+                                      &decoded_magic, &decoded));
+    EXPECT_EQ(decoded_magic, magic);
+    EXPECT_TRUE(decoded == (std::vector<uint64_t>{3, 0x100000000ULL,
+                                                  0xFFFFFFFFFFFFFFFFULL}));
+  }
+}
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the distill tool, run against the checked-in fixture in
+// fixtures/distill. The inputs hold the cmp and edge traces of a single module
+// in the standard and compact formats and both bitnesses, and the expected
+// directory holds the merge results computed by hand. The tests must run from
+// the tests directory, with the distill tool built.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "test.h"
+
+namespace {
+
+#ifdef _WIN32
+const char kDistillPath[] = "..\\distill\\distill.exe";
+#else
+const char kDistillPath[] = "../distill/distill";
+#endif
+
+const char kFixturePath[] = "fixtures/distill";
+const char kOutputPath[] = "distill_output";
+
+const char *const kMergedFiles[] = {
+  "app.merged.sancov",
+  "cmp.app.merged.sancov",
+};
+
+// Reads the whole file at |path|, returning false if it can't be opened.
+bool ReadFile(const std::string& path, std::string *contents) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    return false;
+  }
+
+  contents->clear();
+  char buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), f)) != 0) {
+    contents->append(buffer, read);
+  }
+  fclose(f);
+  return true;
+}
+
+void CreateDirectory(const char *path) {
+#ifdef _WIN32
+  _mkdir(path);
+#else
+  mkdir(path, 0755);
+#endif
+}
+
+void RemoveDirectory(const char *path) {
+#ifdef _WIN32
+  _rmdir(path);
+#else
+  rmdir(path);
+#endif
+}
+
+// Runs the merge command with the given extra flags, and checks that the
+// output files are identical to the expected ones.
+void CheckMerge(const std::string& flags) {
+  CreateDirectory(kOutputPath);
+
+  const std::string command = std::string(kDistillPath) + " merge " + flags +
+                              kOutputPath + " " + kFixturePath + "/inputs";
+  EXPECT_EQ(system(command.c_str()), 0);
+
+  for (const char *name : kMergedFiles) {
+    const std::string output_path = std::string(kOutputPath) + "/" + name;
+    std::string output, expected;
+    EXPECT_TRUE(ReadFile(output_path, &output));
+    EXPECT_TRUE(ReadFile(std::string(kFixturePath) + "/expected/" + name,
+                         &expected));
+    EXPECT_TRUE(output == expected);
+    remove(output_path.c_str());
+  }
+
+  RemoveDirectory(kOutputPath);
+}
+
+}  // namespace
+
+TEST(DistillMergesFixture) {
+  CheckMerge("");
+}
+
+TEST(DistillMergesFixtureInThreads) {
+  CheckMerge("-j 4 ");
+}
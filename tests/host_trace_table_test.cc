@@ -0,0 +1,165 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the host-wide table of traces, kept in shared memory regions
+// created by the tests in the same way as by a fuzzer.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+#include "../source/common.h"
+#include "../source/host_trace_table.h"
+#include "test.h"
+
+namespace {
+
+const uint64_t kModuleId = 0x1234567800000000ULL;
+const uint64_t kOtherModuleId = 0x8765432100000000ULL;
+
+// A zero-filled shared memory region, removed when the object is destroyed.
+class SharedRegion {
+ public:
+  explicit SharedRegion(size_t size) {
+#ifdef _WIN32
+    static int regions_count;
+    char name[64];
+    snprintf(name, sizeof(name), "cmpcov_host_table_test_%lu_%d",
+             GetCurrentProcessId(), regions_count++);
+    id_ = name;
+    mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                  0, static_cast<DWORD>(size), name);
+    if (mapping_ == NULL) {
+      Die("Unable to create the \"%s\" file mapping.\n", name);
+    }
+#else
+    shm_id_ = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shm_id_ == -1) {
+      Die("Unable to create a shared memory segment.\n");
+    }
+    id_ = std::to_string(shm_id_);
+#endif
+  }
+
+  ~SharedRegion() {
+#ifdef _WIN32
+    CloseHandle(mapping_);
+#else
+    shmctl(shm_id_, IPC_RMID, nullptr);
+#endif
+  }
+
+  const char *id() const { return id_.c_str(); }
+
+  // Maps a new view of the region, which stays mapped until the process exits.
+  HostTraceTableHeader *header() const {
+#ifdef _WIN32
+    return static_cast<HostTraceTableHeader *>(
+        MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+#else
+    return static_cast<HostTraceTableHeader *>(shmat(shm_id_, nullptr, 0));
+#endif
+  }
+
+ private:
+#ifdef _WIN32
+  HANDLE mapping_;
+#else
+  int shm_id_;
+#endif
+  std::string id_;
+};
+
+}  // namespace
+
+TEST(HostTraceTableInsertsUniqueTraces) {
+  SharedRegion region(1 << 16);
+  HostTraceTable table(region.id());
+
+  EXPECT_TRUE(table.Insert(kModuleId, 0x1000));
+  EXPECT_TRUE(table.Insert(kModuleId, 0x2000));
+  EXPECT_FALSE(table.Insert(kModuleId, 0x1000));
+  EXPECT_FALSE(table.Insert(kModuleId, 0x2000));
+
+  // Zero is a valid trace like any other.
+  EXPECT_TRUE(table.Insert(kModuleId, 0));
+  EXPECT_FALSE(table.Insert(kModuleId, 0));
+
+  const HostTraceTableHeader *header = region.header();
+  EXPECT_EQ(header->magic.load(), kHostTableMagic);
+  EXPECT_EQ(header->count.load(), 3u);
+  EXPECT_EQ(header->overflow.load(), 0u);
+}
+
+TEST(HostTraceTableSeparatesModules) {
+  SharedRegion region(1 << 16);
+  HostTraceTable table(region.id());
+
+  EXPECT_TRUE(table.Insert(kModuleId, 0x1000));
+  EXPECT_TRUE(table.Insert(kOtherModuleId, 0x1000));
+  EXPECT_FALSE(table.Insert(kOtherModuleId, 0x1000));
+  EXPECT_FALSE(table.Insert(kModuleId, 0x1000));
+}
+
+TEST(HostTraceTableIsSharedBetweenAttachments) {
+  SharedRegion region(1 << 16);
+  HostTraceTable first_table(region.id());
+  HostTraceTable second_table(region.id());
+
+  EXPECT_TRUE(first_table.Insert(kModuleId, 0x1000));
+  EXPECT_FALSE(second_table.Insert(kModuleId, 0x1000));
+  EXPECT_TRUE(second_table.Insert(kModuleId, 0x2000));
+  EXPECT_FALSE(first_table.Insert(kModuleId, 0x2000));
+}
+
+TEST(HostTraceTableCountsOverflows) {
+  // A single page holds the header and 254 slots, of which 128 are used.
+  SharedRegion region(4096);
+  HostTraceTable table(region.id());
+
+  const uint64_t kTracesCount = 200;
+  for (uint64_t i = 0; i < kTracesCount; i++) {
+    EXPECT_TRUE(table.Insert(kModuleId, i));
+  }
+
+  const HostTraceTableHeader *header = region.header();
+  EXPECT_EQ(header->capacity, 128u);
+  EXPECT_TRUE(header->count.load() <= header->capacity);
+  EXPECT_EQ(header->count.load() + header->overflow.load(), kTracesCount);
+
+  // Traces which didn't fit are treated as new every time.
+  size_t new_traces = 0;
+  for (uint64_t i = 0; i < kTracesCount; i++) {
+    if (table.Insert(kModuleId, i)) {
+      new_traces++;
+    }
+  }
+  EXPECT_EQ(new_traces, kTracesCount - header->count.load());
+}
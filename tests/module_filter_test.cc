@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the filter of traced modules.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include "../source/module_filter.h"
+#include "test.h"
+
+namespace {
+
+typedef ModuleFilter::Verdict Verdict;
+
+}  // namespace
+
+TEST(ModuleFilterAcceptsAllModulesByDefault) {
+  ModuleFilter filter("", "");
+  EXPECT_TRUE(filter.GetDefaultVerdict() == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x1000) == Verdict::kUnknownModule);
+
+  filter.Resolve("target", 0x1000, 0x1000);
+  EXPECT_TRUE(filter.Check(0xFFF) == Verdict::kUnknownModule);
+  EXPECT_TRUE(filter.Check(0x1000) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x1FFF) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x2000) == Verdict::kUnknownModule);
+}
+
+TEST(ModuleFilterAcceptsOnlyIncludedModules) {
+  ModuleFilter filter("target,libparser.so", "");
+  EXPECT_TRUE(filter.GetDefaultVerdict() == Verdict::kRejected);
+
+  filter.Resolve("libc.so.6", 0x10000, 0x1000);
+  filter.Resolve("libparser.so", 0x20000, 0x1000);
+  filter.Resolve("target", 0x30000, 0x1000);
+  EXPECT_TRUE(filter.Check(0x10000) == Verdict::kRejected);
+  EXPECT_TRUE(filter.Check(0x20000) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x30000) == Verdict::kAccepted);
+}
+
+TEST(ModuleFilterPrefersExcludedModules) {
+  ModuleFilter filter("target,libz.so.1", "libz.so.1");
+  filter.Resolve("target", 0x10000, 0x1000);
+  filter.Resolve("libz.so.1", 0x20000, 0x1000);
+  EXPECT_TRUE(filter.Check(0x10000) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x20000) == Verdict::kRejected);
+
+  ModuleFilter exclude_filter("", "libz.so.1");
+  EXPECT_TRUE(exclude_filter.GetDefaultVerdict() == Verdict::kAccepted);
+  exclude_filter.Resolve("target", 0x10000, 0x1000);
+  exclude_filter.Resolve("libz.so.1", 0x20000, 0x1000);
+  EXPECT_TRUE(exclude_filter.Check(0x10000) == Verdict::kAccepted);
+  EXPECT_TRUE(exclude_filter.Check(0x20000) == Verdict::kRejected);
+}
+
+TEST(ModuleFilterReplacesOverlappingModules) {
+  ModuleFilter filter("", "libz.so.1");
+  filter.Resolve("target", 0x10000, 0x1000);
+  filter.Resolve("libz.so.1", 0x20000, 0x2000);
+  filter.Resolve("libpng.so", 0x30000, 0x1000);
+
+  // A module loaded in place of the unloaded libz.so.1, overlapping its end.
+  filter.Resolve("libplugin.so", 0x21000, 0x2000);
+  EXPECT_TRUE(filter.Check(0x10000) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x20000) == Verdict::kUnknownModule);
+  EXPECT_TRUE(filter.Check(0x21000) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x22FFF) == Verdict::kAccepted);
+  EXPECT_TRUE(filter.Check(0x30000) == Verdict::kAccepted);
+
+  // The excluded module loaded back at its old address.
+  filter.Resolve("libz.so.1", 0x20000, 0x2000);
+  EXPECT_TRUE(filter.Check(0x20000) == Verdict::kRejected);
+  EXPECT_TRUE(filter.Check(0x21FFF) == Verdict::kRejected);
+  EXPECT_TRUE(filter.Check(0x22000) == Verdict::kUnknownModule);
+}
+
+TEST(ModuleFilterHandlesManyModules) {
+  ModuleFilter filter("", "excluded");
+
+  // Resolved in a descending order of addresses, alternating the verdicts.
+  const size_t kModulesCount = 100;
+  for (size_t i = kModulesCount; i > 0; i--) {
+    filter.Resolve((i % 2) ? "excluded" : "included", i * 0x10000, 0x1000);
+  }
+  for (size_t i = 1; i <= kModulesCount; i++) {
+    const Verdict expected = (i % 2) ? Verdict::kRejected : Verdict::kAccepted;
+    EXPECT_TRUE(filter.Check(i * 0x10000) == expected);
+    EXPECT_TRUE(filter.Check(i * 0x10000 + 0x1000) == Verdict::kUnknownModule);
+  }
+}
+
+TEST(ModuleFilterChecksDuringUpdates) {
+  ModuleFilter filter("", "excluded");
+  filter.Resolve("target", 0x10000, 0x1000);
+
+  // Load and unload modules around the target, while another thread keeps
+  // checking it.
+  std::atomic<bool> done(false);
+  std::atomic<int> wrong_verdicts(0);
+  std::thread checker([&]() {
+    while (!done.load()) {
+      if (filter.Check(0x10800) != Verdict::kAccepted) {
+        wrong_verdicts++;
+      }
+    }
+  });
+
+  for (int i = 0; i < 100000; i++) {
+    filter.Resolve((i % 2) ? "excluded" : "plugin", 0x20000 + (i % 64) * 0x100,
+                   0x100);
+  }
+  done.store(true);
+  checker.join();
+
+  EXPECT_EQ(wrong_verdicts.load(), 0);
+}
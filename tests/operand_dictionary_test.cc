@@ -0,0 +1,153 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the dictionary of comparison operands.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../source/operand_dictionary.h"
+#include "test.h"
+
+namespace {
+
+typedef std::vector<std::pair<size_t, std::string>> TokenList;
+
+const size_t kSitePc = 0x401234;
+const size_t kOtherSitePc = 0x405678;
+
+void AddString(OperandDictionary *dictionary, size_t pc,
+               const std::string& token) {
+  dictionary->Add(pc, token.data(), token.size());
+}
+
+// Returns the tokens of the dictionary in a deterministic order.
+TokenList GetSortedTokens(const OperandDictionary& dictionary) {
+  TokenList tokens = dictionary.GetTokens();
+  std::sort(tokens.begin(), tokens.end());
+  return tokens;
+}
+
+}  // namespace
+
+TEST(OperandDictionaryStoresTokensOncePerSite) {
+  OperandDictionary dictionary(16);
+  AddString(&dictionary, kSitePc, "magic");
+  AddString(&dictionary, kSitePc, "magic");
+  AddString(&dictionary, kSitePc, "other");
+  AddString(&dictionary, kOtherSitePc, "magic");
+
+  const TokenList expected = {
+    {kSitePc, "magic"}, {kSitePc, "other"}, {kOtherSitePc, "magic"},
+  };
+  EXPECT_TRUE(GetSortedTokens(dictionary) == expected);
+  EXPECT_EQ(dictionary.GetDroppedCount(), 0u);
+}
+
+TEST(OperandDictionaryKeepsBinaryTokens) {
+  OperandDictionary dictionary(16);
+  const uint8_t token[] = {0x00, 0xFF, 0x00, 0x7F};
+  dictionary.Add(kSitePc, token, sizeof(token));
+
+  const TokenList tokens = dictionary.GetTokens();
+  EXPECT_EQ(tokens.size(), 1u);
+  EXPECT_TRUE(tokens[0].second ==
+              std::string(reinterpret_cast<const char *>(token),
+                          sizeof(token)));
+}
+
+TEST(OperandDictionaryIgnoresEmptyTokens) {
+  OperandDictionary dictionary(16);
+  dictionary.Add(kSitePc, "", 0);
+  EXPECT_TRUE(dictionary.GetTokens().empty());
+  EXPECT_EQ(dictionary.GetDroppedCount(), 0u);
+}
+
+TEST(OperandDictionaryTruncatesLongTokens) {
+  OperandDictionary dictionary(16);
+  const std::string token(kMaxTokenLength + 10, 'A');
+  AddString(&dictionary, kSitePc, token);
+
+  // Operands sharing the first kMaxTokenLength bytes are the same token.
+  AddString(&dictionary, kSitePc, std::string(kMaxTokenLength + 1, 'A'));
+  AddString(&dictionary, kSitePc, std::string(kMaxTokenLength, 'A'));
+
+  const TokenList tokens = dictionary.GetTokens();
+  EXPECT_EQ(tokens.size(), 1u);
+  EXPECT_TRUE(tokens[0].second == token.substr(0, kMaxTokenLength));
+}
+
+TEST(OperandDictionaryCountsDroppedTokens) {
+  // The dictionary has 8 slots for at most 4 tokens.
+  OperandDictionary dictionary(4);
+  for (int i = 0; i < 6; i++) {
+    AddString(&dictionary, kSitePc, "token" + std::to_string(i));
+  }
+  EXPECT_EQ(dictionary.GetTokens().size(), 4u);
+  EXPECT_EQ(dictionary.GetDroppedCount(), 2u);
+
+  // Tokens already stored or dropped aren't counted again.
+  for (int i = 0; i < 6; i++) {
+    AddString(&dictionary, kSitePc, "token" + std::to_string(i));
+  }
+  EXPECT_EQ(dictionary.GetTokens().size(), 4u);
+  EXPECT_EQ(dictionary.GetDroppedCount(), 2u);
+
+  // Once all slots are claimed, new tokens are counted at every attempt.
+  for (int i = 6; i < 10; i++) {
+    AddString(&dictionary, kSitePc, "token" + std::to_string(i));
+  }
+  EXPECT_EQ(dictionary.GetDroppedCount(), 6u);
+  AddString(&dictionary, kSitePc, "token9");
+  AddString(&dictionary, kSitePc, "token10");
+  EXPECT_EQ(dictionary.GetDroppedCount(), 8u);
+  EXPECT_EQ(dictionary.GetTokens().size(), 4u);
+}
+
+TEST(OperandDictionaryHandlesConcurrentAdds) {
+  const int kThreadsCount = 8;
+  const int kTokensCount = 200;
+  OperandDictionary dictionary(kTokensCount);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadsCount; i++) {
+    threads.emplace_back([&dictionary]() {
+      for (int j = 0; j < kTokensCount; j++) {
+        AddString(&dictionary, kSitePc, "token" + std::to_string(j));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  const TokenList tokens = GetSortedTokens(dictionary);
+  EXPECT_EQ(tokens.size() + dictionary.GetDroppedCount(),
+            static_cast<size_t>(kTokensCount));
+  EXPECT_TRUE(std::adjacent_find(tokens.begin(), tokens.end()) ==
+              tokens.end());
+}
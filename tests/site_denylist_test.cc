@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the list of comparison sites which aren't instrumented.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../source/site_denylist.h"
+#include "test.h"
+
+namespace {
+
+const char kDenylistPath[] = "site_denylist_test.txt";
+
+// Writes |contents| to the denylist file and loads it into |denylist|.
+void LoadDenylist(SiteDenylist *denylist, const char *contents) {
+  FILE *f = fopen(kDenylistPath, "w");
+  fputs(contents, f);
+  fclose(f);
+
+  denylist->Load(kDenylistPath);
+  remove(kDenylistPath);
+}
+
+}  // namespace
+
+TEST(SiteDenylistResolvesSitesPerModule) {
+  SiteDenylist denylist;
+  LoadDenylist(&denylist,
+               "# A comment.\n"
+               "libexample.so 0x1a2b3c 12345 further fields\n"
+               "\n"
+               "target 0x100\n"
+               "target 200\n");
+  EXPECT_EQ(denylist.GetSitesCount(), 3u);
+  EXPECT_EQ(denylist.size(), 0u);
+  EXPECT_FALSE(denylist.Contains(0x10100));
+
+  denylist.Resolve("target", 0x10000);
+  EXPECT_EQ(denylist.size(), 2u);
+  EXPECT_TRUE(denylist.Contains(0x10100));
+  EXPECT_TRUE(denylist.Contains(0x10200));
+  EXPECT_FALSE(denylist.Contains(0x10000));
+  EXPECT_FALSE(denylist.Contains(0x1a2b3c));
+
+  denylist.Resolve("libexample.so", 0x7F0000000000);
+  EXPECT_EQ(denylist.size(), 3u);
+  EXPECT_TRUE(denylist.Contains(0x7F00001a2b3c));
+  EXPECT_TRUE(denylist.Contains(0x10100));
+}
+
+TEST(SiteDenylistIgnoresUnlistedModules) {
+  SiteDenylist denylist;
+  LoadDenylist(&denylist, "target 0x100\n");
+  denylist.Resolve("libc.so.6", 0x10000);
+  EXPECT_EQ(denylist.size(), 0u);
+  EXPECT_FALSE(denylist.Contains(0x10100));
+}
+
+TEST(SiteDenylistResolvesReloadedModules) {
+  SiteDenylist denylist;
+  LoadDenylist(&denylist, "plugin.so 0x10\nplugin.so 0x20\n");
+
+  // The same instance resolved again doesn't take more slots.
+  denylist.Resolve("plugin.so", 0x10000);
+  denylist.Resolve("plugin.so", 0x10000);
+  EXPECT_EQ(denylist.size(), 2u);
+
+  // The table has room for a single instance of every site, so the further
+  // instances of a module loaded at different addresses are ignored.
+  denylist.Resolve("plugin.so", 0x20000);
+  EXPECT_TRUE(denylist.Contains(0x10010));
+  EXPECT_TRUE(denylist.Contains(0x10020));
+  EXPECT_TRUE(denylist.size() <= 2u);
+}
+
+TEST(SiteDenylistIsEmptyWithoutFile) {
+  SiteDenylist denylist;
+  EXPECT_EQ(denylist.GetSitesCount(), 0u);
+  denylist.Resolve("target", 0x10000);
+  EXPECT_FALSE(denylist.Contains(0x10000));
+}
@@ -0,0 +1,128 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the sampling policy for hot comparison sites.
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "../source/site_throttle.h"
+#include "test.h"
+
+namespace {
+
+const size_t kSitePc = 0x401234;
+
+// Returns the number of executions of the site skipped before the next
+// evaluation, or |limit| if the site isn't evaluated within |limit| checks.
+uint32_t CountSkipped(SiteThrottle *throttle, size_t pc, uint32_t generation,
+                      uint32_t limit) {
+  uint32_t skipped = 0;
+  while (skipped < limit && !throttle->ShouldEvaluate(pc, generation)) {
+    skipped++;
+  }
+  return skipped;
+}
+
+}  // namespace
+
+TEST(SiteThrottleEvaluatesUntilThreshold) {
+  SiteThrottle throttle(/*threshold=*/3);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+  }
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_FALSE(throttle.ShouldEvaluate(kSitePc, 0));
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+}
+
+TEST(SiteThrottleBacksOffExponentially) {
+  SiteThrottle throttle(/*threshold=*/1);
+  for (uint32_t expected = 1; expected <= 1024; expected *= 2) {
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+    EXPECT_EQ(CountSkipped(&throttle, kSitePc, 0, 1 << 20), expected);
+  }
+}
+
+TEST(SiteThrottleLimitsBackOff) {
+  SiteThrottle throttle(/*threshold=*/1);
+  for (int i = 0; i < 40; i++) {
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+  }
+  EXPECT_EQ(CountSkipped(&throttle, kSitePc, 0, 1 << 20), 0xFFFFu);
+}
+
+TEST(SiteThrottleResetsOnProgress) {
+  SiteThrottle throttle(/*threshold=*/2);
+  for (int i = 0; i < 5; i++) {
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+  }
+  throttle.Report(kSitePc, 0, /*progress=*/true);
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+
+  // The streak starts over after the progress.
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_EQ(CountSkipped(&throttle, kSitePc, 0, 100), 1u);
+}
+
+TEST(SiteThrottleIgnoresOlderGenerations) {
+  SiteThrottle throttle(/*threshold=*/1);
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 1));
+
+  // The streak of the old generation doesn't carry over.
+  throttle.Report(kSitePc, 1, /*progress=*/false);
+  EXPECT_EQ(CountSkipped(&throttle, kSitePc, 1, 100), 1u);
+
+  // Neither does a generation differing only above the lower 8 bits.
+  throttle.Report(kSitePc, 1, /*progress=*/false);
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 1 + 256));
+}
+
+TEST(SiteThrottleSupportsMaxThreshold) {
+  SiteThrottle throttle(SiteThrottle::kMaxThreshold);
+  for (uint32_t i = 1; i < SiteThrottle::kMaxThreshold; i++) {
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+    EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc, 0));
+  }
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_EQ(CountSkipped(&throttle, kSitePc, 0, 100), 1u);
+
+  // The back-off still reaches its limit with the maximum threshold.
+  for (int i = 0; i < 20; i++) {
+    throttle.Report(kSitePc, 0, /*progress=*/false);
+  }
+  EXPECT_EQ(CountSkipped(&throttle, kSitePc, 0, 1 << 20), 0xFFFFu);
+}
+
+TEST(SiteThrottleTracksSitesSeparately) {
+  SiteThrottle throttle(/*threshold=*/1);
+  throttle.Report(kSitePc, 0, /*progress=*/false);
+  EXPECT_TRUE(throttle.ShouldEvaluate(kSitePc + 1, 0));
+  EXPECT_FALSE(throttle.ShouldEvaluate(kSitePc, 0));
+}
@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the cache of preprocessed switch statements.
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "../source/switch_cache.h"
+#include "test.h"
+
+// The layout of the Cases[] arrays is the same as in
+// __sanitizer_cov_trace_switch: the number of cases, the width of the
+// compared value in bits, and the case constants.
+
+TEST(SwitchCacheKeepsOnlyWideCases) {
+  SwitchCache cache;
+  const uint64_t cases[] = {6, 64, 0x1, 0xFF, 0x100, 0x12345678, 0x7,
+                            0x123456789ABCDEF0ULL};
+  const SwitchCache::Entry *entry = cache.Get(cases);
+  EXPECT_TRUE(entry != nullptr);
+  EXPECT_TRUE(entry->cases == cases);
+  EXPECT_EQ(entry->cases_count, 6u);
+
+  EXPECT_EQ(entry->wide_cases.size(), 3u);
+  EXPECT_EQ(entry->wide_cases[0].index, 2u);
+  EXPECT_EQ(entry->wide_cases[0].width, 2);
+  EXPECT_EQ(entry->wide_cases[1].index, 3u);
+  EXPECT_EQ(entry->wide_cases[1].width, 4);
+  EXPECT_EQ(entry->wide_cases[2].index, 5u);
+  EXPECT_EQ(entry->wide_cases[2].width, 8);
+}
+
+TEST(SwitchCacheHandlesOnlyNarrowCases) {
+  SwitchCache cache;
+  const uint64_t cases[] = {3, 8, 0x1, 0x2, 0x3};
+  const SwitchCache::Entry *entry = cache.Get(cases);
+  EXPECT_TRUE(entry != nullptr);
+  EXPECT_TRUE(entry->wide_cases.empty());
+}
+
+TEST(SwitchCacheReusesEntries) {
+  SwitchCache cache;
+  const uint64_t first[] = {1, 32, 0x1000};
+  const uint64_t second[] = {1, 32, 0x1000};
+  const SwitchCache::Entry *entry = cache.Get(first);
+  EXPECT_TRUE(cache.Get(first) == entry);
+
+  // Identical switches at different addresses are cached separately.
+  const SwitchCache::Entry *other_entry = cache.Get(second);
+  EXPECT_TRUE(other_entry != nullptr);
+  EXPECT_TRUE(other_entry != entry);
+  EXPECT_TRUE(other_entry->cases == second);
+}
+
+TEST(SwitchCacheRejectsStaleEntries) {
+  SwitchCache cache;
+  uint64_t cases[] = {1, 32, 0x1000, 0x2000};
+  EXPECT_TRUE(cache.Get(cases) != nullptr);
+
+  // A switch with a different number of cases at the same address, e.g. in a
+  // module loaded in place of an unloaded one.
+  cases[0] = 2;
+  EXPECT_TRUE(cache.Get(cases) == nullptr);
+}
@@ -0,0 +1,57 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// A minimal framework for the unit tests of the internal classes of cmpcov.
+// Every test is a function defined with the TEST macro, which registers it at
+// startup, and checks its expectations with the EXPECT_* macros. A failed
+// expectation is reported and marks the test as failed, but doesn't stop it.
+
+#ifndef CMPCOV_TESTS_TEST_H_
+#define CMPCOV_TESTS_TEST_H_
+
+#include <cstdint>
+
+// Registers a test function under the specified name.
+class TestRegistration {
+ public:
+  TestRegistration(const char *name, void (*function)());
+};
+
+// Reports a failed expectation of the currently running test.
+void ReportFailure(const char *file, int line, const char *expression);
+
+#define TEST(name)                                             \
+  static void name();                                          \
+  static TestRegistration name##_registration(#name, name);    \
+  static void name()
+
+#define EXPECT_TRUE(condition)                                 \
+  do {                                                         \
+    if (!(condition)) {                                        \
+      ReportFailure(__FILE__, __LINE__, #condition);           \
+    }                                                          \
+  } while (0)
+
+#define EXPECT_FALSE(condition) EXPECT_TRUE(!(condition))
+#define EXPECT_EQ(a, b) EXPECT_TRUE((a) == (b))
+
+#endif  // CMPCOV_TESTS_TEST_H_
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// The runner of the unit tests, see test.h. Runs all registered tests, or the
+// ones whose names are passed in the command line, and reports the results.
+// The exit code is non-zero if any of the tests has failed.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+struct Test {
+  const char *name;
+  void (*function)();
+};
+
+// Allocated on first use, as the tests are registered by static initializers
+// of other translation units.
+std::vector<Test>& GetTests() {
+  static std::vector<Test> tests;
+  return tests;
+}
+
+int current_failures;
+
+}  // namespace
+
+TestRegistration::TestRegistration(const char *name, void (*function)()) {
+  GetTests().push_back({name, function});
+}
+
+void ReportFailure(const char *file, int line, const char *expression) {
+  fprintf(stderr, "%s:%d: expectation failed: %s\n", file, line, expression);
+  current_failures++;
+}
+
+int main(int argc, char **argv) {
+  int failed_tests = 0, run_tests = 0;
+  for (const Test& test : GetTests()) {
+    bool selected = (argc == 1);
+    for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], test.name)) {
+        selected = true;
+      }
+    }
+    if (!selected) {
+      continue;
+    }
+
+    current_failures = 0;
+    test.function();
+    run_tests++;
+
+    if (current_failures != 0) {
+      failed_tests++;
+      printf("[FAIL] %s\n", test.name);
+    } else {
+      printf("[ OK ] %s\n", test.name);
+    }
+  }
+
+  printf("%d of %d tests passed.\n", run_tests - failed_tests, run_tests);
+  return (failed_tests != 0) ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the TraceTable class.
+
+#include <cstdint>
+
+#include "../source/trace_table.h"
+#include "test.h"
+
+TEST(TraceTableInsertsUniqueTraces) {
+  TraceTable table(/*capacity=*/16);
+  EXPECT_TRUE(table.Insert(0x1234));
+  EXPECT_FALSE(table.Insert(0x1234));
+  EXPECT_TRUE(table.Insert(0x1235));
+  EXPECT_TRUE(table.Contains(0x1234));
+  EXPECT_TRUE(table.Contains(0x1235));
+  EXPECT_FALSE(table.Contains(0x1236));
+  EXPECT_EQ(table.size(), 2u);
+}
+
+TEST(TraceTableHandlesEmptySlotValue) {
+  // Zero marks the empty slots internally, but is a valid trace.
+  TraceTable table(/*capacity=*/16);
+  EXPECT_FALSE(table.Contains(0));
+  EXPECT_TRUE(table.Insert(0));
+  EXPECT_FALSE(table.Insert(0));
+  EXPECT_TRUE(table.Contains(0));
+  EXPECT_EQ(table.size(), 1u);
+}
+
+TEST(TraceTableGrowsBeyondCapacity) {
+  TraceTable table(/*capacity=*/4);
+  const uint64_t kCount = 10000;
+  for (uint64_t i = 0; i < kCount; i++) {
+    EXPECT_TRUE(table.Insert(i * 0x10001 + 1));
+  }
+  EXPECT_EQ(table.size(), kCount);
+
+  for (uint64_t i = 0; i < kCount; i++) {
+    EXPECT_TRUE(table.Contains(i * 0x10001 + 1));
+    EXPECT_FALSE(table.Insert(i * 0x10001 + 1));
+  }
+  EXPECT_FALSE(table.Contains(kCount * 0x10001 + 1));
+}
+
+TEST(TraceTableClearForgetsAllTraces) {
+  TraceTable table(/*capacity=*/16);
+  for (uint64_t i = 0; i < 100; i++) {
+    table.Insert(i);
+  }
+  table.Clear();
+  EXPECT_EQ(table.size(), 0u);
+
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_FALSE(table.Contains(i));
+  }
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_TRUE(table.Insert(i));
+  }
+}
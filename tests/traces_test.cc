@@ -0,0 +1,81 @@
+/////////////////////////////////////////////////////////////////////////
+//
+// Author: Mateusz Jurczyk (mjurczyk@google.com)
+//
+// Copyright 2019 Google LLC
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+// https://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// Description
+// ===========
+//
+// Tests of the packing of module indexes and output traces.
+
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+#include "../source/common.h"
+#include "../source/traces.h"
+#include "test.h"
+
+namespace {
+
+// Packs the pair and checks that unpacking it yields the same values.
+bool RoundTrip(int module_index, size_t output_trace) {
+  uint64_t packed_trace = 0;
+  if (!Traces::PackTrace(module_index, output_trace, &packed_trace)) {
+    return false;
+  }
+  return Traces::UnpackTrace(packed_trace) ==
+         std::make_pair(module_index, output_trace);
+}
+
+}  // namespace
+
+TEST(TracesPackRoundTrips) {
+  EXPECT_TRUE(RoundTrip(0, 0));
+  EXPECT_TRUE(RoundTrip(1, 0x1234));
+  EXPECT_TRUE(RoundTrip(7, 0x89ABCDEF));
+}
+
+#if WORDSIZE == 64
+
+// The largest offset which fits in the packed form, i.e. just below 64 GiB.
+static const size_t kMaxPackedOffset = (1ULL << 36) - 1;
+
+// Returns an output trace with the given offset and arguments, laid out in
+// the same way as in Traces::ConstructWideTrace.
+static size_t MakeOutputTrace(size_t offset, int trace_arg1, int trace_arg2) {
+  return offset | (static_cast<size_t>(trace_arg2) << 48) |
+         (static_cast<size_t>(trace_arg1) << 60);
+}
+
+TEST(TracesPackAcceptsLimits) {
+  EXPECT_TRUE(RoundTrip(4095, 0));
+  EXPECT_TRUE(RoundTrip(0, kMaxPackedOffset));
+  EXPECT_TRUE(RoundTrip(1, MakeOutputTrace(0x1234, 15, 4095)));
+  EXPECT_TRUE(RoundTrip(
+      4095, MakeOutputTrace(kMaxPackedOffset, 15, 4095)));
+}
+
+TEST(TracesPackRejectsExceededLimits) {
+  uint64_t packed_trace = 0;
+  EXPECT_FALSE(Traces::PackTrace(4096, 0, &packed_trace));
+  EXPECT_FALSE(Traces::PackTrace(0, kMaxPackedOffset + 1, &packed_trace));
+  EXPECT_FALSE(Traces::PackTrace(
+      0, MakeOutputTrace(1ULL << 47, 1, 2), &packed_trace));
+}
+
+#endif  // WORDSIZE == 64